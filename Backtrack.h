@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+
+#include "Program.h"
+#include "Prefilter.h"
+#include "Budget.h"
+
+namespace regix {
+    // bytecode interpreter exploring threads depth first in priority order
+    // every (pc, position) pair is visited at most once so it stays O(program * input) like the PikeVM,
+    // but it only pays for the path it takes which makes it the faster choice for short inputs
+    struct Backtrack {
+        // upper bound of the visited bitmap in bits
+        static constexpr size_t maxVisited = 256 * 1024;
+
+        struct Job {
+            uint32_t pc;
+            long pos;
+            // when slot is set the job restores scratch[slot] to pos instead of running
+            long slot;
+            // a job with last > pos stands for running pc at every position up to last, highest first
+            long last;
+        };
+
+        // buffers reused between runs, the bitmap never needs more than maxVisited bits
+        struct Scratch {
+            std::vector<uint64_t> visited;
+            std::vector<long> scratch;
+            std::vector<Job> stack;
+
+            void prepare(size_t bits, size_t slotCount) {
+                visited.assign((bits + 63) / 64, 0);
+                scratch.assign(slotCount, -1);
+                stack.clear();
+            }
+        };
+
+        const Program& prog;
+
+        explicit Backtrack(const Program& prog): prog(prog) {}
+
+        bool fits(std::string_view source) const {
+            return prog.insts.size() * (source.size() + 1) <= maxVisited;
+        }
+
+        // same contract as PikeVM::run, source must fit
+        long run(std::string_view source, bool fullMatch, std::vector<long>& slots) const {
+            Scratch s;
+            return run(source, fullMatch, slots, s);
+        }
+
+        long run(std::string_view source, bool fullMatch, std::vector<long>& slots, Scratch& s,
+                 Budget* budget = nullptr) const {
+            s.prepare(prog.insts.size() * (source.size() + 1), slots.size());
+            return exec(source, 0, fullMatch, slots, s, budget);
+        }
+
+        // same contract as PikeVM::search, source must fit
+        // the visited bitmap is shared by all candidate starts, a pair that failed once fails from any start
+        long search(std::string_view source, const Prefilter& prefilter, std::vector<long>& slots) const {
+            Scratch s;
+            return search(source, prefilter, slots, s);
+        }
+
+        long search(std::string_view source, const Prefilter& prefilter, std::vector<long>& slots, Scratch& s,
+                    Budget* budget = nullptr) const {
+            s.prepare(prog.insts.size() * (source.size() + 1), slots.size());
+
+            for (auto pos = prefilter.next(source, 0); pos != Prefilter::npos; pos = prefilter.next(source, pos + 1)) {
+                auto res = exec(source, pos, false, slots, s, budget);
+                if (res >= 0 || res == Budget::Exceeded) return res;
+            }
+            return -1;
+        }
+
+    private:
+        long exec(std::string_view source, long start, bool fullMatch, std::vector<long>& slots, Scratch& s,
+                  Budget* budget) const {
+            auto width = source.size() + 1;
+            auto& visited = s.visited;
+            auto& scratch = s.scratch;
+            auto& stack = s.stack;
+
+            stack.push_back({0, start, -1, start});
+
+            while (!stack.empty()) {
+                auto job = stack.back();
+                stack.pop_back();
+
+                if (job.slot >= 0) {
+                    scratch[job.slot] = job.pos;
+                    continue;
+                }
+
+                auto pc = job.pc;
+                auto pos = job.last;
+                if (job.last > job.pos) stack.push_back({job.pc, job.pos, -1, job.last - 1});
+
+                while (true) {
+                    // every instruction visited is a step
+                    if (budget && budget->charge(1)) {
+                        stack.clear();
+                        return Budget::Exceeded;
+                    }
+
+                    long bit = pc * width + pos;
+                    if (visited[bit / 64] & (uint64_t(1) << (bit % 64))) break;
+                    visited[bit / 64] |= uint64_t(1) << (bit % 64);
+
+                    auto& inst = prog.insts[pc];
+                    if (inst.op == Op::Split && inst.c) {
+                        // whole run of the loop body at once, every iteration leaves the loop as alternative
+                        auto& body = prog.insts[pc + 1];
+                        auto left = source.size() - pos;
+                        long run = body.op == Op::Any ? left : prog.spans[body.x](source.data() + pos, left);
+
+                        // an iteration explored before ends the run like it would one byte at a time
+                        auto seen = firstSet(visited, bit + 1, bit + run + 1) - bit;
+                        setRange(visited, bit + 1, bit + std::min(seen, run + 1));
+
+                        if (seen <= run) {
+                            stack.push_back({inst.x, pos, -1, pos + seen - 1});
+                            break;
+                        }
+                        if (run > 0) stack.push_back({inst.x, pos, -1, pos + run - 1});
+                        pc = inst.x;
+                        pos += run;
+                    }
+                    else if (inst.op == Op::Split) {
+                        stack.push_back({inst.x, pos, -1, pos});
+                        pc++;
+                    }
+                    else if (inst.op == Op::Jmp) {
+                        pc = inst.x;
+                    }
+                    else if (inst.op == Op::Save) {
+                        if (inst.x < scratch.size()) {
+                            stack.push_back({0, scratch[inst.x], (long) inst.x, 0});
+                            scratch[inst.x] = pos;
+                        }
+                        pc++;
+                    }
+                    else if (inst.op == Op::Repeat) {
+                        // the longest run first and every shorter one down to min as alternative, a Repeat is
+                        // always entered with nothing counted so the (pc, position) pair still decides the rest
+                        auto& counter = prog.counters[inst.x];
+                        auto left = std::min<size_t>(source.size() - pos, counter.max);
+                        long run = prog.spans[counter.cls](source.data() + pos, left);
+                        if (run < (long) counter.min) break;
+
+                        if (run > (long) counter.min) stack.push_back({pc + 1, pos + counter.min, -1, pos + run - 1});
+                        pc++;
+                        pos += run;
+                    }
+                    else if (inst.op == Op::Match) {
+                        if (fullMatch && (size_t) pos != source.size()) break;
+
+                        // first match reached is the one with highest priority
+                        std::copy(scratch.begin(), scratch.end(), slots.begin());
+                        stack.clear();
+                        return pos;
+                    }
+                    else if ((size_t) pos < source.size() && prog.matches(inst, source[pos])) {
+                        pc++;
+                        pos++;
+                    }
+                    else {
+                        break;
+                    }
+                }
+            }
+
+            return -1;
+        }
+
+        // index of the first set bit in [from, to), to when there is none
+        static long firstSet(const std::vector<uint64_t>& bits, long from, long to) {
+            for (auto i = from; i < to;) {
+                auto word = bits[i / 64] >> (i % 64);
+                if (word) return std::min(i + __builtin_ctzll(word), to);
+                i += 64 - i % 64;
+            }
+            return to;
+        }
+
+        static void setRange(std::vector<uint64_t>& bits, long from, long to) {
+            for (auto i = from; i < to;) {
+                auto count = std::min<long>(64 - i % 64, to - i);
+                auto mask = count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1) << (i % 64);
+                bits[i / 64] |= mask;
+                i += count;
+            }
+        }
+    };
+}
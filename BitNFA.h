@@ -0,0 +1,416 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+#include "Program.h"
+#include "Prefilter.h"
+
+namespace regix {
+    // Glushkov automaton of a small program run bit-parallel, every consuming instruction is a position and the
+    // NFA state is the set of positions that consumed the last byte, kept as a few machine words
+    // every edge into a position carries the byte set of that position, so a step is
+    //     state = follow(state) & masks[byte]
+    // follow moves the state one position on with a shift and keeps the single byte loops with an and, the few
+    // positions with other edges select their targets without a branch and past maxSources of them the targets
+    // come from tables indexed by the bytes of the state, patterns laid out in order need few of those
+    // a Repeat is one position with a counter next to the state, the counts below min are bits shifted on with
+    // every byte of its class and only the smallest count past min is kept as a number, that one expires last,
+    // so the position leads on exactly while that number is set
+    // there is no cache to fill or throw away and matching allocates nothing, time is linear in the input with a
+    // factor of the number of words
+    struct BitNFA {
+        static constexpr size_t maxWords = 4;
+        static constexpr size_t maxPositions = 64 * maxWords;
+        // positions with other edges handled one by one, a table lookup sits on the path from one step to the next
+        // while these only load constants
+        static constexpr size_t maxSources = 8;
+        // Repeat counters and the words all of their bits take
+        static constexpr size_t maxCounters = 4;
+        static constexpr size_t maxCounterWords = 16;
+        static constexpr size_t npos = std::string_view::npos;
+
+        // nullptr when the program has more than maxPositions consuming instructions or its counters take more
+        // than the counter limits
+        static std::unique_ptr<BitNFA> compile(const Program& prog) {
+            std::unique_ptr<BitNFA> res(new BitNFA());
+            std::vector<uint32_t> index(prog.insts.size(), UINT32_MAX);
+            std::vector<uint32_t> pcs;
+            size_t counterWords = 0;
+            for (uint32_t pc = 0; pc < prog.insts.size(); pc++) {
+                auto& inst = prog.insts[pc];
+                if (inst.op == Op::Repeat) {
+                    auto& counter = prog.counters[inst.x];
+                    uint32_t words = (counter.min + 62) / 64;
+                    res->counters.push_back({(uint32_t) pcs.size(), counter.min, counter.max,
+                                             (uint32_t) counterWords, words});
+                    counterWords += words;
+                }
+                if (inst.op == Op::Char || inst.op == Op::Any || inst.op == Op::Class || inst.op == Op::Repeat) {
+                    index[pc] = pcs.size();
+                    pcs.push_back(pc);
+                }
+            }
+            if (pcs.size() > maxPositions) return nullptr;
+            if (res->counters.size() > maxCounters || counterWords > maxCounterWords) return nullptr;
+
+            res->positions = pcs.size();
+            res->words = std::max<size_t>((pcs.size() + 63) / 64, 1);
+            auto words = res->words;
+
+            // positions reachable from pc without consuming input, matched tells whether a Match is among them
+            std::vector<uint32_t> stack;
+            std::vector<bool> seen(prog.insts.size());
+            auto closure = [&](uint32_t start, uint64_t* out, bool& matched) {
+                std::fill(seen.begin(), seen.end(), false);
+                stack.assign(1, start);
+                matched = false;
+
+                while (!stack.empty()) {
+                    auto pc = stack.back();
+                    stack.pop_back();
+                    if (pc >= prog.insts.size() || seen[pc]) continue;
+                    seen[pc] = true;
+
+                    auto& inst = prog.insts[pc];
+                    switch (inst.op) {
+                        case Op::Jmp:
+                            stack.push_back(inst.x);
+                            break;
+                        case Op::Split:
+                            stack.push_back(inst.x);
+                            stack.push_back(pc + 1);
+                            break;
+                        case Op::Save:
+                            stack.push_back(pc + 1);
+                            break;
+                        case Op::Match:
+                            matched = true;
+                            break;
+                        case Op::Repeat:
+                            if (prog.counters[inst.x].min == 0) stack.push_back(pc + 1);
+                            out[index[pc] / 64] |= uint64_t(1) << (index[pc] % 64);
+                            break;
+                        default:
+                            out[index[pc] / 64] |= uint64_t(1) << (index[pc] % 64);
+                    }
+                }
+            };
+
+            closure(0, res->first.data(), res->emptyMatch);
+
+            // follow of every position split into the shift, the self loop and the rest
+            std::vector<uint64_t> rest(pcs.size() * words);
+            std::vector<uint32_t> sources;
+            for (size_t p = 0; p < pcs.size(); p++) {
+                auto follow = rest.data() + p * words;
+                bool matched;
+                closure(pcs[p] + 1, follow, matched);
+
+                auto bit = [&](size_t q) -> bool {
+                    return q < pcs.size() && (follow[q / 64] >> (q % 64)) & 1;
+                };
+                auto take = [&](std::array<uint64_t, maxWords>& mask, size_t q) {
+                    mask[p / 64] |= uint64_t(1) << (p % 64);
+                    follow[q / 64] &= ~(uint64_t(1) << (q % 64));
+                };
+
+                if (matched) res->last[p / 64] |= uint64_t(1) << (p % 64);
+                if (bit(p + 1)) take(res->shift, p + 1);
+                if (bit(p)) take(res->self, p);
+                if (std::any_of(follow, follow + words, [](auto w) { return w != 0; })) sources.push_back(p);
+            }
+
+            res->masks.assign(256 * words, 0);
+            for (unsigned c = 0; c < 256; c++) {
+                for (size_t p = 0; p < pcs.size(); p++) {
+                    if (prog.matches(prog.insts[pcs[p]], c)) {
+                        res->masks[c * words + p / 64] |= uint64_t(1) << (p % 64);
+                    }
+                }
+            }
+
+            if (sources.size() <= maxSources) {
+                res->sources = sources;
+                for (auto p : sources) {
+                    res->targets.insert(res->targets.end(), rest.begin() + p * words, rest.begin() + (p + 1) * words);
+                }
+                return res;
+            }
+
+            // a table for every byte of the state holding a position with other edges, entry b is the union of
+            // the rest of the positions set in b, built from the entry without the lowest bit
+            for (size_t k = 0; k < 8 * words; k++) {
+                if (std::none_of(sources.begin(), sources.end(), [&](auto p) { return p / 8 == k; })) continue;
+
+                res->chunks.push_back(k);
+                auto table = res->jumps.size();
+                res->jumps.resize(table + 256 * words, 0);
+                for (unsigned b = 1; b < 256; b++) {
+                    auto p = 8 * k + __builtin_ctz(b);
+                    auto to = res->jumps.data() + table + b * words;
+                    auto from = res->jumps.data() + table + (b & (b - 1)) * words;
+                    for (size_t w = 0; w < words; w++) {
+                        to[w] = from[w] | (p < pcs.size() ? rest[p * words + w] : 0);
+                    }
+                }
+            }
+
+            return res;
+        }
+
+        // full match of source
+        bool doesMatch(std::string_view source) const {
+            switch (words) {
+                case 1:
+                    return full<1>(source);
+                case 2:
+                    return full<2>(source);
+                case 3:
+                    return full<3>(source);
+                default:
+                    return full<4>(source);
+            }
+        }
+
+        // end of the earliest ending match anywhere in source, npos when there is none
+        // with a prefilter the scan skips ahead to the next candidate whenever no position is alive
+        size_t firstAccept(std::string_view source, const Prefilter* prefilter = nullptr) const {
+            switch (words) {
+                case 1:
+                    return search<1>(source, prefilter);
+                case 2:
+                    return search<2>(source, prefilter);
+                case 3:
+                    return search<3>(source, prefilter);
+                default:
+                    return search<4>(source, prefilter);
+            }
+        }
+
+        bool contains(std::string_view source, const Prefilter* prefilter = nullptr) const {
+            return firstAccept(source, prefilter) != npos;
+        }
+
+        size_t positionCount() const {
+            return positions;
+        }
+
+        size_t memoryUsage() const {
+            return sizeof(BitNFA) + (masks.size() + targets.size() + jumps.size()) * sizeof(uint64_t) +
+                   sources.size() * sizeof(uint32_t) + chunks.size() + counters.size() * sizeof(Counting);
+        }
+
+    private:
+        struct Counting {
+            uint32_t position;
+            uint32_t min;
+            uint32_t max;
+            // words of Counts::bits holding the counts from 1 to min - 1
+            uint32_t offset;
+            uint32_t words;
+        };
+
+        // counters of one scan, bit k of a counter's words is a thread that took k + 1 bytes, youngest is the
+        // smallest count at or past min and 0 when there is none
+        struct Counts {
+            uint64_t bits[maxCounterWords];
+            uint32_t youngest[maxCounters];
+
+            void clear() {
+                std::fill(std::begin(bits), std::end(bits), 0);
+                std::fill(std::begin(youngest), std::end(youngest), 0);
+            }
+        };
+
+        size_t positions = 0;
+        size_t words = 1;
+        bool emptyMatch = false;
+        // positions entered by the first byte, positions after which the program can accept
+        std::array<uint64_t, maxWords> first{};
+        std::array<uint64_t, maxWords> last{};
+        // positions followed by the next one, positions followed by themselves
+        std::array<uint64_t, maxWords> shift{};
+        std::array<uint64_t, maxWords> self{};
+        // masks[c * words + w] holds the positions consuming byte c
+        std::vector<uint64_t> masks;
+        // position sources[i] is also followed by targets[i * words, (i + 1) * words)
+        std::vector<uint32_t> sources;
+        std::vector<uint64_t> targets;
+        // used instead past maxSources, byte k of the state owns the table jumps[i * 256 * words, (i + 1) * 256 * words) when chunks[i] is k
+        std::vector<uint8_t> chunks;
+        std::vector<uint64_t> jumps;
+        std::vector<Counting> counters;
+
+        BitNFA() = default;
+
+        // word i of state picked with constant indices, indexing it directly would keep the state in memory
+        template<size_t W>
+        static uint64_t wordOf(const uint64_t* state, size_t i) {
+            uint64_t res = 0;
+            for (size_t w = 0; w < W; w++) {
+                res |= w == i ? state[w] : 0;
+            }
+            return res;
+        }
+
+        template<size_t W>
+        void follow(const uint64_t* state, uint64_t* out) const {
+            uint64_t carry = 0;
+            for (size_t w = 0; w < W; w++) {
+                auto moved = state[w] & shift[w];
+                out[w] = (moved << 1) | carry | (state[w] & self[w]);
+                carry = moved >> 63;
+            }
+            for (size_t i = 0; i < sources.size(); i++) {
+                auto p = sources[i];
+                auto on = uint64_t(0) - ((wordOf<W>(state, p / 64) >> (p % 64)) & 1);
+                for (size_t w = 0; w < W; w++) {
+                    out[w] |= targets[i * W + w] & on;
+                }
+            }
+            for (size_t i = 0; i < chunks.size(); i++) {
+                auto k = chunks[i];
+                auto b = (wordOf<W>(state, k / 8) >> (k % 8 * 8)) & 0xff;
+                auto table = jumps.data() + (i * 256 + b) * W;
+                for (size_t w = 0; w < W; w++) {
+                    out[w] |= table[w];
+                }
+            }
+        }
+
+        // moves the counters on by the byte whose mask made state, a counter position set in state was entered
+        // and starts a thread at one byte, afterwards it is set while any thread of the counter is alive
+        template<size_t W>
+        void count(uint64_t* state, const uint64_t* mask, Counts& counts) const {
+            for (size_t k = 0; k < counters.size(); k++) {
+                auto& counter = counters[k];
+                auto bit = uint64_t(1) << (counter.position % 64);
+                auto& word = state[counter.position / 64];
+                auto bits = counts.bits + counter.offset;
+                auto& youngest = counts.youngest[k];
+
+                // a byte outside the class ends every thread at once
+                if (!(mask[counter.position / 64] & bit)) {
+                    std::fill(bits, bits + counter.words, 0);
+                    youngest = 0;
+                    continue;
+                }
+
+                // the smallest count reaching min is a thread entered now, one moving up from min - 1 or the last one
+                uint64_t entered = (word & bit) != 0;
+                auto below = counter.min > 0 ? counter.min - 1 : 0;
+                uint32_t next = 0;
+                if (entered && counter.min <= 1) next = 1;
+                else if (below && (bits[(below - 1) / 64] >> ((below - 1) % 64)) & 1) next = counter.min;
+                else if (youngest) next = youngest + 1;
+                youngest = next <= counter.max ? next : 0;
+
+                uint64_t carry = entered;
+                uint64_t alive = youngest;
+                for (size_t w = 0; w < counter.words; w++) {
+                    auto moved = (bits[w] << 1) | carry;
+                    carry = bits[w] >> 63;
+                    // the count of min went to youngest
+                    if (w + 1 == counter.words && below % 64) moved &= (uint64_t(1) << (below % 64)) - 1;
+                    bits[w] = moved;
+                    alive |= moved;
+                }
+                word = alive ? word | bit : word & ~bit;
+            }
+        }
+
+        // state as its edges see it, a counter position only leads on while some thread counted to min, view
+        // holds the copy when the program has counters
+        template<size_t W>
+        const uint64_t* edges(const uint64_t* state, uint64_t* view, const Counts& counts) const {
+            if (counters.empty()) return state;
+
+            std::copy(state, state + W, view);
+            for (size_t k = 0; k < counters.size(); k++) {
+                auto p = counters[k].position;
+                if (!counts.youngest[k]) view[p / 64] &= ~(uint64_t(1) << (p % 64));
+            }
+            return view;
+        }
+
+        template<size_t W>
+        bool full(std::string_view source) const {
+            if (source.empty()) return emptyMatch;
+
+            uint64_t state[W];
+            uint64_t view[W];
+            Counts counts;
+            if (!counters.empty()) counts.clear();
+
+            auto mask = masks.data() + (unsigned char) source[0] * W;
+            for (size_t w = 0; w < W; w++) {
+                state[w] = first[w] & mask[w];
+            }
+            if (!counters.empty()) count<W>(state, mask, counts);
+
+            for (size_t i = 1; i < source.size(); i++) {
+                uint64_t next[W];
+                follow<W>(edges<W>(state, view, counts), next);
+
+                mask = masks.data() + (unsigned char) source[i] * W;
+                for (size_t w = 0; w < W; w++) {
+                    state[w] = next[w] & mask[w];
+                }
+                if (!counters.empty()) count<W>(state, mask, counts);
+
+                uint64_t alive = 0;
+                for (size_t w = 0; w < W; w++) {
+                    alive |= state[w];
+                }
+                if (!alive) return false;
+            }
+
+            auto seen = edges<W>(state, view, counts);
+            uint64_t accepted = 0;
+            for (size_t w = 0; w < W; w++) {
+                accepted |= seen[w] & last[w];
+            }
+            return accepted != 0;
+        }
+
+        // a match may start at every byte, so first is added to the state before each step
+        template<size_t W>
+        size_t search(std::string_view source, const Prefilter* prefilter) const {
+            if (emptyMatch) return 0;
+
+            uint64_t state[W]{};
+            uint64_t view[W];
+            Counts counts;
+            if (!counters.empty()) counts.clear();
+
+            bool alive = false;
+            for (size_t i = 0; i < source.size(); i++) {
+                if (prefilter && !alive && (i = prefilter->next(source, i)) == Prefilter::npos) return npos;
+
+                uint64_t next[W];
+                follow<W>(edges<W>(state, view, counts), next);
+
+                auto mask = masks.data() + (unsigned char) source[i] * W;
+                for (size_t w = 0; w < W; w++) {
+                    state[w] = (next[w] | first[w]) & mask[w];
+                }
+                if (!counters.empty()) count<W>(state, mask, counts);
+
+                auto seen = edges<W>(state, view, counts);
+                uint64_t any = 0;
+                uint64_t accepted = 0;
+                for (size_t w = 0; w < W; w++) {
+                    any |= state[w];
+                    accepted |= seen[w] & last[w];
+                }
+                if (accepted) return i + 1;
+                alive = any != 0;
+            }
+            return npos;
+        }
+    };
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <algorithm>
+
+namespace regix {
+    // bound on the work of a single call for patterns and inputs that cant be trusted, in engine steps,
+    // a wall clock deadline or both, the engines charge steps as they go and the clock is only read
+    // every checkInterval steps so a check is one compare in the common case
+    // what a step is depends on the engine, a thread at a position for the PikeVM, an instruction for the
+    // backtracker, a byte for the DFA and a node entered or a byte scanned for the tree, so a step limit is a
+    // bound on work and not on input length
+    struct Budget {
+        using Clock = std::chrono::steady_clock;
+
+        // returned by match when the budget ran out, -1 keeps meaning no match
+        static constexpr long Exceeded = -2;
+        static constexpr size_t checkInterval = 1024;
+
+        // 0 is no step limit
+        size_t maxSteps = 0;
+        // shared by every call until it is changed, max is no deadline
+        Clock::time_point deadline = Clock::time_point::max();
+
+        bool limited() const {
+            return maxSteps || deadline != Clock::time_point::max();
+        }
+
+        // resets the step count for a new call, nullptr when there is nothing to enforce so the engines
+        // skip the accounting altogether
+        Budget* begin() {
+            steps = 0;
+            hit = false;
+            if (!limited()) return nullptr;
+
+            checkAt = maxSteps ? std::min(checkInterval, maxSteps + 1) : checkInterval;
+            // a deadline that already passed fails on the first charge
+            if (deadline != Clock::time_point::max()) checkAt = 0;
+            return this;
+        }
+
+        // adds n steps, true once the budget is exhausted
+        bool charge(size_t n) {
+            steps += n;
+            return steps >= checkAt && check();
+        }
+
+        // whether the last call stopped because of the budget, the only way to tell for doesMatch and search
+        bool exceeded() const {
+            return hit;
+        }
+
+        size_t used() const {
+            return steps;
+        }
+
+    private:
+        size_t steps = 0;
+        size_t checkAt = 0;
+        bool hit = false;
+
+        bool check() {
+            if (maxSteps && steps > maxSteps) hit = true;
+            if (deadline != Clock::time_point::max() && Clock::now() >= deadline) hit = true;
+
+            checkAt = steps + checkInterval;
+            if (maxSteps) checkAt = std::min(checkAt, maxSteps + 1);
+            return hit;
+        }
+    };
+}
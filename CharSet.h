@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace regix {
+    // set of bytes stored as a 256 bit bitmap
+    struct CharSet {
+        std::array<uint64_t, 4> bits{};
+
+        constexpr void set(unsigned char c) {
+            bits[c >> 6] |= uint64_t(1) << (c & 63);
+        }
+
+        constexpr void setRange(unsigned char from, unsigned char to) {
+            for (unsigned c = from; c <= to; c++) {
+                set(c);
+            }
+        }
+
+        constexpr bool contains(unsigned char c) const {
+            return (bits[c >> 6] >> (c & 63)) & 1;
+        }
+
+        constexpr bool empty() const {
+            return (bits[0] | bits[1] | bits[2] | bits[3]) == 0;
+        }
+
+        constexpr CharSet operator~() const {
+            return {{~bits[0], ~bits[1], ~bits[2], ~bits[3]}};
+        }
+
+        constexpr CharSet& operator|=(const CharSet& other) {
+            for (auto i = 0; i < 4; i++) {
+                bits[i] |= other.bits[i];
+            }
+            return *this;
+        }
+
+        constexpr bool operator==(const CharSet& other) const = default;
+
+        static constexpr CharSet range(unsigned char from, unsigned char to) {
+            CharSet res;
+            res.setRange(from, to);
+            return res;
+        }
+
+        // ascii tables used by the \l, \d and \w shorthands, independent of the locale
+        static constexpr CharSet letters() {
+            auto res = range('a', 'z');
+            res |= range('A', 'Z');
+            return res;
+        }
+
+        static constexpr CharSet digits() {
+            return range('0', '9');
+        }
+
+        static constexpr CharSet whitespace() {
+            auto res = range('\t', '\r');
+            res.set(' ');
+            return res;
+        }
+    };
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <string_view>
+
+#include "Regix.h"
+
+namespace regix {
+    // the node tree copied into one array of tagged nodes and matched by a single switch on the kind, a step is a
+    // direct branch inside one function instead of a virtual call per node, and the nodes of a pattern sit next to
+    // each other instead of wherever the arena put them
+    // results and captures are the ones of the tree, there is no budget
+    struct FlatTree {
+        struct Node {
+            Kind kind;
+            char c = 0;
+            // retry can find a shorter match, like givesBack
+            bool back = false;
+            // Group and Capture: first index into kids, Literal: offset into bytes, CharClass: index of the set,
+            // XAndMore, Repeat, Optional, Not: inner node, Or: left node
+            uint32_t a = 0;
+            // Group and Capture: number of kids, Literal: length, Or: right node
+            uint32_t b = 0;
+            // index into spans when a repeat scans single bytes, NoSpan otherwise
+            uint32_t span = NoSpan;
+            // XAndMore: amount, Repeat: bounds, Capture: id in min, all of them below maxRepeatCount
+            uint32_t min = 0;
+            uint32_t max = 0;
+        };
+
+        static constexpr uint32_t NoSpan = UINT32_MAX;
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> kids;
+        std::vector<CharSet> sets;
+        std::vector<Span> spans;
+        std::string bytes;
+
+        explicit FlatTree(Regix& root) {
+            add(root);
+        }
+
+        // length of the match at the start of source or -1, like Regix::match
+        long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches) const {
+            return run(0, source, matches);
+        }
+
+        bool doesMatch(std::string_view source) const {
+            std::vector<std::vector<std::string_view>> matches;
+            return run(0, source, matches) == (long) source.size();
+        }
+
+    private:
+        uint32_t add(Regix& node) {
+            uint32_t at = nodes.size();
+            nodes.push_back({node.kind});
+
+            auto list = [&](NodeList& inner) {
+                std::vector<uint32_t> ids;
+                for (auto& in : inner) {
+                    ids.push_back(add(*in));
+                }
+                nodes[at].a = kids.size();
+                nodes[at].b = ids.size();
+                nodes[at].back = ids.size() == 1 && nodes[ids[0]].back;
+                kids.insert(kids.end(), ids.begin(), ids.end());
+            };
+            auto scan = [&](Regix& inner) {
+                CharSet set;
+                if (!inner.byteSet(set)) return;
+                nodes[at].span = spans.size();
+                spans.emplace_back(set);
+            };
+
+            switch (node.kind) {
+                case Kind::Any:
+                    break;
+                case Kind::Char:
+                    nodes[at].c = static_cast<Char&>(node).c;
+                    break;
+                case Kind::Literal: {
+                    auto& str = static_cast<Literal&>(node).str;
+                    nodes[at].a = bytes.size();
+                    nodes[at].b = str.size();
+                    bytes += str;
+                    break;
+                }
+                case Kind::CharClass:
+                    nodes[at].a = sets.size();
+                    sets.push_back(static_cast<CharClass&>(node).set);
+                    break;
+                case Kind::XAndMore: {
+                    auto& repeat = static_cast<XAndMore&>(node);
+                    scan(*repeat.inner);
+                    nodes[at].min = repeat.amount;
+                    auto inner = add(*repeat.inner);
+                    nodes[at].a = inner;
+                    break;
+                }
+                case Kind::Repeat: {
+                    auto& repeat = static_cast<Repeat&>(node);
+                    scan(*repeat.inner);
+                    nodes[at].min = repeat.min;
+                    nodes[at].max = repeat.max;
+                    nodes[at].back = repeat.min < repeat.max;
+                    auto inner = add(*repeat.inner);
+                    nodes[at].a = inner;
+                    break;
+                }
+                case Kind::Optional: {
+                    auto inner = add(*static_cast<Optional&>(node).inner);
+                    nodes[at].a = inner;
+                    break;
+                }
+                case Kind::Not: {
+                    auto inner = add(*static_cast<Not&>(node).inner);
+                    nodes[at].a = inner;
+                    break;
+                }
+                case Kind::Capture: {
+                    auto& capture = static_cast<Capture&>(node);
+                    nodes[at].min = capture.id;
+                    list(capture.inner);
+                    break;
+                }
+                case Kind::Group:
+                    list(static_cast<Group&>(node).inner);
+                    break;
+                case Kind::Or: {
+                    auto& alternation = static_cast<Or&>(node);
+                    auto left = add(*alternation.left);
+                    auto right = add(*alternation.right);
+                    nodes[at].a = left;
+                    nodes[at].b = right;
+                    break;
+                }
+            }
+            return at;
+        }
+
+        // single byte nodes and literals are tested right here, the rest goes through compound
+        __attribute__((always_inline))
+        long run(uint32_t at, std::string_view source, std::vector<std::vector<std::string_view>>& matches) const {
+            auto& node = nodes[at];
+            switch (node.kind) {
+                case Kind::Any:
+                    return source.empty() ? -1 : 1;
+                case Kind::Char:
+                    return !source.empty() && source[0] == node.c ? 1 : -1;
+                case Kind::Literal:
+                    if (source.size() < node.b || memcmp(source.data(), bytes.data() + node.a, node.b) != 0) return -1;
+                    return node.b;
+                case Kind::CharClass:
+                    return !source.empty() && sets[node.a].contains(source[0]) ? 1 : -1;
+                default:
+                    return compound(node, source, matches);
+            }
+        }
+
+        __attribute__((noinline))
+        long compound(const Node& node, std::string_view source,
+                      std::vector<std::vector<std::string_view>>& matches) const {
+            switch (node.kind) {
+                case Kind::XAndMore: {
+                    if (node.span != NoSpan) {
+                        size_t len = spans[node.span](source.data(), source.size());
+                        return len >= node.min ? len : -1;
+                    }
+
+                    size_t count = 0;
+                    long total = 0;
+                    while (true) {
+                        auto res = run(node.a, utils::slice(source, total), matches);
+                        if (res < 0) return count >= node.min ? total : -1;
+                        count++;
+                        total += res;
+                        if (res == 0) return total;
+                    }
+                }
+                case Kind::Repeat: {
+                    if (node.span != NoSpan) {
+                        size_t len = spans[node.span](source.data(), std::min<size_t>(source.size(), node.max));
+                        return len >= node.min ? len : -1;
+                    }
+                    size_t count;
+                    return rounds(node, source, matches, LONG_MAX, node.max, count);
+                }
+                case Kind::Optional: {
+                    auto res = run(node.a, source, matches);
+                    return res < 0 ? 0 : res;
+                }
+                case Kind::Capture: {
+                    auto res = sequence(node.a, node.a + node.b, source, matches);
+                    if (res >= 0) record(node, source, matches, res);
+                    return res;
+                }
+                case Kind::Group:
+                    return sequence(node.a, node.a + node.b, source, matches);
+                case Kind::Or: {
+                    auto res = run(node.a, source, matches);
+                    return res < 0 ? run(node.b, source, matches) : res;
+                }
+                case Kind::Not:
+                    if (source.empty()) return -1;
+                    return run(node.a, source, matches) < 0 ? 1 : -1;
+                default:
+                    return -1;
+            }
+        }
+
+        // Regix::retry of the node at
+        long retry(uint32_t at, std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   long below) const {
+            auto& node = nodes[at];
+            switch (node.kind) {
+                case Kind::Repeat: {
+                    if (below <= 0) return -1;
+                    if (node.span != NoSpan) return size_t(below - 1) >= node.min ? below - 1 : -1;
+
+                    auto marks = captureMarks(matches);
+                    size_t count;
+                    auto res = rounds(node, source, matches, below, node.max, count);
+                    if (res < 0 || marks == captureMarks(matches)) return res;
+
+                    dropCaptures(matches, marks);
+                    return rounds(node, source, matches, below, count, count);
+                }
+                case Kind::Capture: {
+                    if (node.b != 1) return -1;
+                    auto res = retry(kids[node.a], source, matches, below);
+                    if (res >= 0) record(node, source, matches, res);
+                    return res;
+                }
+                case Kind::Group:
+                    return node.b == 1 ? retry(kids[node.a], source, matches, below) : -1;
+                default:
+                    return -1;
+            }
+        }
+
+        // matchSequence over kids[from, to)
+        long sequence(uint32_t from, uint32_t to, std::string_view source,
+                      std::vector<std::vector<std::string_view>>& matches) const {
+            long total = 0;
+            for (auto i = from; i < to; i++) {
+                auto src = utils::slice(source, total);
+
+                if (i + 1 < to && nodes[kids[i]].back) {
+                    auto marks = captureMarks(matches);
+                    auto res = run(kids[i], src, matches);
+                    while (res >= 0) {
+                        auto rest = sequence(i + 1, to, utils::slice(src, res), matches);
+                        if (rest >= 0) return total + res + rest;
+
+                        dropCaptures(matches, marks);
+                        res = retry(kids[i], src, matches, res);
+                    }
+                    return -1;
+                }
+
+                auto res = run(kids[i], src, matches);
+                if (res < 0) return -1;
+                total += res;
+            }
+            return total;
+        }
+
+        // Repeat::rounds
+        long rounds(const Node& node, std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                    long below, size_t limit, size_t& count) const {
+            count = 0;
+            long total = 0;
+            while (count < limit) {
+                auto res = run(node.a, utils::slice(source, total), matches);
+                if (res < 0 || total + res >= below) break;
+
+                count++;
+                total += res;
+                if (res == 0) return total;
+            }
+            return count >= node.min ? total : -1;
+        }
+
+        void record(const Node& node, std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                    long length) const {
+            if (matches.size() <= node.min) matches.resize(node.min + 1);
+            matches[node.min].push_back(utils::slice(source, 0, length));
+        }
+    };
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <initializer_list>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+#include "LazyDFA.h"
+
+namespace regix {
+    // full match compiled to x86-64, the DFA of the program is built up front and every state becomes a block
+    // of code that loads one byte and branches on byte ranges straight to the block of the next state,
+    // so the input pointer stays in a register and state is the instruction pointer
+    // patterns whose DFA is too large, or other architectures, get no code and stay on the interpreters
+    struct JitCode {
+        using Fn = bool (*)(const unsigned char* at, const unsigned char* end);
+
+        // nullptr when the program has no native form
+        static std::unique_ptr<JitCode> compile(const Program& prog, size_t maxStates = 1024) {
+#if defined(__x86_64__)
+            std::vector<State> states;
+            if (!buildStates(prog, maxStates, states)) return nullptr;
+
+            auto code = emit(states);
+            if (code.empty()) return nullptr;
+
+            auto size = (code.size() + 4095) & ~size_t(4095);
+            auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) return nullptr;
+
+            memcpy(mem, code.data(), code.size());
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, size);
+                return nullptr;
+            }
+
+            return std::unique_ptr<JitCode>(new JitCode(mem, size, code.size()));
+#else
+            return nullptr;
+#endif
+        }
+
+        JitCode(const JitCode&) = delete;
+        JitCode& operator=(const JitCode&) = delete;
+
+        ~JitCode() {
+#if defined(__x86_64__)
+            munmap(mem, mapped);
+#endif
+        }
+
+        bool doesMatch(std::string_view source) const {
+            auto at = (const unsigned char*) source.data();
+            return ((Fn) mem)(at, at + source.size());
+        }
+
+        size_t codeSize() const {
+            return size;
+        }
+
+    private:
+        // targets below 0 are the shared exits
+        static constexpr long Reject = -1;
+        static constexpr long Accept = -2;
+
+        struct State {
+            bool accepting;
+            // next state by byte, Reject for the dead state
+            std::array<long, 256> next;
+        };
+
+        void* mem;
+        size_t mapped;
+        size_t size;
+
+        JitCode(void* mem, size_t mapped, size_t size): mem(mem), mapped(mapped), size(size) {}
+
+        // every state of the lazy DFA, gives up when it has too many or its cache clears
+        static bool buildStates(const Program& prog, size_t maxStates, std::vector<State>& states) {
+            LazyDFA dfa(prog, 64 << 20);
+            auto order = dfa.reachableStates(maxStates);
+            if (!order) return false;
+
+            std::map<uint32_t, long> index;
+            for (size_t i = 0; i < order->size(); i++) {
+                index[(*order)[i]] = i;
+            }
+
+            for (auto id : *order) {
+                State state{dfa.isAccepting(id), {}};
+                for (unsigned c = 0; c < 256; c++) {
+                    auto next = dfa.next(id, c);
+                    state.next[c] = next == LazyDFA::Dead ? Reject : index.at(next);
+                }
+                states.push_back(state);
+            }
+            return true;
+        }
+
+        struct Assembler {
+            std::vector<unsigned char> code;
+            // rel32 fields and the state or exit they jump to
+            std::vector<std::pair<size_t, long>> fixups;
+
+            void bytes(std::initializer_list<unsigned char> b) {
+                code.insert(code.end(), b);
+            }
+
+            void imm32(uint32_t v) {
+                for (auto i = 0; i < 4; i++) {
+                    code.push_back(v >> (8 * i));
+                }
+            }
+
+            void jump(std::initializer_list<unsigned char> op, long target) {
+                bytes(op);
+                fixups.push_back({code.size(), target});
+                imm32(0);
+            }
+        };
+
+        // calling convention is rdi = at and rsi = end, every state block is
+        //   cmp rdi, rsi / jae exit / movzx eax, byte [rdi] / inc rdi
+        // followed by one test and jump per byte range, the widest target is reached by a final jmp
+        static std::vector<unsigned char> emit(const std::vector<State>& states) {
+            Assembler a;
+            std::vector<size_t> labels(states.size());
+
+            for (size_t s = 0; s < states.size(); s++) {
+                auto& state = states[s];
+                labels[s] = a.code.size();
+
+                a.bytes({0x48, 0x39, 0xf7});
+                a.jump({0x0f, 0x83}, state.accepting ? Accept : Reject);
+                a.bytes({0x0f, 0xb6, 0x07});
+                a.bytes({0x48, 0xff, 0xc7});
+
+                // ranges of bytes going to the same target, the target covering most bytes is left for last
+                std::map<long, size_t> width;
+                for (auto t : state.next) {
+                    width[t]++;
+                }
+                auto fallback = std::max_element(width.begin(), width.end(), [](auto& x, auto& y) {
+                    return x.second < y.second;
+                })->first;
+
+                for (unsigned lo = 0; lo < 256;) {
+                    auto hi = lo;
+                    while (hi < 255 && state.next[hi + 1] == state.next[lo]) hi++;
+
+                    auto target = state.next[lo];
+                    if (target != fallback) {
+                        if (lo == hi) {
+                            // cmp al, lo / je target
+                            a.bytes({0x3c, (unsigned char) lo});
+                            a.jump({0x0f, 0x84}, target);
+                        }
+                        else {
+                            // lea ecx, [rax - lo] / cmp ecx, hi - lo / jbe target
+                            a.bytes({0x8d, 0x88});
+                            a.imm32(-lo);
+                            a.bytes({0x81, 0xf9});
+                            a.imm32(hi - lo);
+                            a.jump({0x0f, 0x86}, target);
+                        }
+                    }
+                    lo = hi + 1;
+                }
+                a.jump({0xe9}, fallback);
+            }
+
+            auto reject = a.code.size();
+            // xor eax, eax / ret
+            a.bytes({0x31, 0xc0, 0xc3});
+            auto accept = a.code.size();
+            // mov eax, 1 / ret
+            a.bytes({0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3});
+
+            for (auto [at, target] : a.fixups) {
+                size_t to = target == Reject ? reject : target == Accept ? accept : labels[target];
+                uint32_t rel = to - (at + 4);
+                memcpy(a.code.data() + at, &rel, 4);
+            }
+
+            return std::move(a.code);
+        }
+    };
+}
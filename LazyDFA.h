@@ -0,0 +1,402 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+
+#include "PikeVM.h"
+
+namespace regix {
+    // DFA determinized on demand from the program, a state is the set of NFA instructions alive at a position
+    // transitions are cached in one flat table indexed by state and byte class so every input byte is one lookup
+    // when the cache outgrows memoryLimit it is thrown away and rebuilt, scans that keep clearing fall back to the PikeVM
+    // a program counting with Repeat has no state set standing for its counts, the DFA opts out of it and every scan
+    // takes the fallback
+    struct LazyDFA {
+        static constexpr uint32_t Unknown = UINT32_MAX;
+        static constexpr uint32_t Dead = 0;
+
+        const Program& prog;
+        size_t memoryLimit;
+        // cache clears tolerated during a single scan before giving up on the DFA
+        size_t clearLimit;
+
+        size_t cacheClears = 0;
+        size_t fallbacks = 0;
+
+        explicit LazyDFA(const Program& prog, size_t memoryLimit = 1 << 20, size_t clearLimit = 3):
+            prog(prog), memoryLimit(memoryLimit), clearLimit(clearLimit),
+            counted(std::any_of(prog.insts.begin(), prog.insts.end(), [](auto& inst) {
+                return inst.op == Op::Repeat;
+            })) {
+            computeByteClasses();
+            clearCache();
+        }
+
+        // false when the DFA opted out of the program, the try scans give up then and state level access is off
+        bool supported() const {
+            return !counted;
+        }
+
+        // false when the budget runs out, which budget->exceeded() tells apart from no match
+        bool doesMatch(std::string_view source, Budget* budget = nullptr) {
+            if (auto res = tryDoesMatch(source, budget)) return *res;
+
+            fallbacks++;
+            PikeVM::Scratch s;
+            std::vector<long> slots;
+            return PikeVM(prog).run(source, true, slots, s, budget) >= 0;
+        }
+
+        // full match of source, nullopt when the cache thrashed or the DFA opted out
+        // with a budget every byte is a step, charged a block at a time
+        std::optional<bool> tryDoesMatch(std::string_view source, Budget* budget = nullptr) {
+            if (counted) return std::nullopt;
+            size_t clearsBefore = cacheClears;
+
+            if (start == Unknown) start = addState(closure({0}));
+            auto state = start;
+
+            for (size_t i = 0; i < source.size(); i++) {
+                if (budget && i % Budget::checkInterval == 0 &&
+                    budget->charge(std::min(Budget::checkInterval, source.size() - i))) {
+                    return false;
+                }
+
+                auto next = advance(state, source[i], clearsBefore);
+                if (next == Unknown) return std::nullopt;
+                if (next == Dead) return false;
+                state = next;
+            }
+
+            return accepting[state / stride];
+        }
+
+        // smallest position at which the state accepts, with an unanchored program the end of the earliest
+        // ending match, npos when there is none and nullopt when the cache thrashed
+        std::optional<size_t> tryFirstAccept(std::string_view source) {
+            if (counted) return std::nullopt;
+            size_t clearsBefore = cacheClears;
+
+            auto state = startState();
+            if (accepting[state / stride]) return 0;
+
+            for (size_t i = 0; i < source.size(); i++) {
+                auto next = advance(state, source[i], clearsBefore);
+                if (next == Unknown) return std::nullopt;
+                if (next == Dead) return std::string_view::npos;
+                state = next;
+
+                if (accepting[state / stride]) return i + 1;
+            }
+
+            return std::string_view::npos;
+        }
+
+        // full match of every row data[offsets[i], offsets[i + 1]) of a column, onMatch(i) is called for each
+        // matching row in order, the start state and the cache stay warm from one row to the next
+        template<class Offset, class F>
+        void doesMatchRows(const char* data, const Offset* offsets, size_t rows, F&& onMatch) {
+            for (size_t i = 0; i < rows; i++) {
+                std::string_view row(data + offsets[i], offsets[i + 1] - offsets[i]);
+
+                auto res = tryDoesMatch(row);
+                if (!res) {
+                    fallbacks++;
+                    res = PikeVM(prog).doesMatch(row);
+                }
+                if (*res) onMatch(i);
+            }
+        }
+
+        // marks matched[id] for the x of every Match instruction reached while scanning the whole source,
+        // with atEnd only the ones alive after the last byte count
+        void collect(std::string_view source, bool atEnd, std::vector<bool>& matched) {
+            if (tryCollect(source, atEnd, matched)) return;
+
+            fallbacks++;
+            collectWithoutCache(source, atEnd, matched);
+        }
+
+        bool tryCollect(std::string_view source, bool atEnd, std::vector<bool>& matched) {
+            if (counted) return false;
+            size_t clearsBefore = cacheClears;
+
+            if (start == Unknown) start = addState(closure({0}));
+            auto state = start;
+            auto mark = [&](uint32_t s) {
+                for (auto id : matchIds[s / stride]) {
+                    matched[id] = true;
+                }
+            };
+
+            for (unsigned char c : source) {
+                if (!atEnd && accepting[state / stride]) mark(state);
+
+                auto next = advance(state, c, clearsBefore);
+                if (next == Unknown) return false;
+                if (next == Dead) return true;
+                state = next;
+            }
+            mark(state);
+
+            return true;
+        }
+
+        // state level access for callers driving the DFA themselves, ids are only valid until cacheClears changes
+
+        uint32_t startState() {
+            if (start == Unknown) start = addState(closure({0}));
+            return start;
+        }
+
+        uint32_t stateOf(std::vector<uint32_t> set) {
+            return addState(std::move(set));
+        }
+
+        const std::vector<uint32_t>& setOf(uint32_t state) const {
+            return sets[state / stride];
+        }
+
+        bool isAccepting(uint32_t state) const {
+            return accepting[state / stride];
+        }
+
+        // transition of state on c, when the cache gets cleared on the way the result lives in the new one
+        uint32_t next(uint32_t state, unsigned char c) {
+            auto res = table[state + byteClasses[c]];
+            if (res != Unknown) return res;
+
+            res = computeNext(state, c);
+            return res != Unknown ? res : computeNext(rebuilt, c);
+        }
+
+        // states reachable from the start in breadth first order, start first and the dead state left out,
+        // nullopt when there are more than maxStates or the cache cleared on the way
+        std::optional<std::vector<uint32_t>> reachableStates(size_t maxStates) {
+            if (counted) return std::nullopt;
+            size_t clearsBefore = cacheClears;
+            std::vector<uint32_t> res{startState()};
+            std::set<uint32_t> seen{res[0]};
+
+            for (size_t i = 0; i < res.size(); i++) {
+                for (unsigned c = 0; c < 256; c++) {
+                    // one byte per class is enough, the rest share its transition
+                    if (c > 0 && byteClasses[c] == byteClasses[c - 1]) continue;
+
+                    auto to = next(res[i], c);
+                    if (cacheClears != clearsBefore) return std::nullopt;
+                    if (to == Dead || !seen.insert(to).second) continue;
+
+                    if (res.size() >= maxStates) return std::nullopt;
+                    res.push_back(to);
+                }
+            }
+            return res;
+        }
+
+        // bytes the program does not tell apart share a class, transitions are stored per class
+        uint8_t byteClass(unsigned char c) const {
+            return byteClasses[c];
+        }
+
+        size_t classCount() const {
+            return stride;
+        }
+
+        // runs source from state and adds one to count for every byte after which the state accepts,
+        // returns the state reached or nullopt when the cache thrashed
+        std::optional<uint32_t> walk(uint32_t state, std::string_view source, size_t& count, bool stopAtMatch) {
+            if (counted) return std::nullopt;
+            size_t clearsBefore = cacheClears;
+
+            for (unsigned char c : source) {
+                auto next = advance(state, c, clearsBefore);
+                if (next == Unknown) return std::nullopt;
+                if (next == Dead) return Dead;
+                state = next;
+
+                if (accepting[state / stride]) {
+                    count++;
+                    if (stopAtMatch) break;
+                }
+            }
+
+            return state;
+        }
+
+        // instructions reachable from pcs without consuming input, sorted so equal sets share a state
+        std::vector<uint32_t> closure(std::vector<uint32_t> stack) const {
+            std::vector<uint32_t> res;
+            std::vector<bool> seen(prog.insts.size());
+
+            while (!stack.empty()) {
+                auto pc = stack.back();
+                stack.pop_back();
+
+                if (seen[pc]) continue;
+                seen[pc] = true;
+
+                auto& inst = prog.insts[pc];
+                switch (inst.op) {
+                    case Op::Jmp:
+                        stack.push_back(inst.x);
+                        break;
+                    case Op::Split:
+                        stack.push_back(inst.x);
+                        stack.push_back(pc + 1);
+                        break;
+                    case Op::Save:
+                        stack.push_back(pc + 1);
+                        break;
+                    default:
+                        res.push_back(pc);
+                }
+            }
+
+            std::sort(res.begin(), res.end());
+            return res;
+        }
+
+        std::vector<uint32_t> step(const std::vector<uint32_t>& set, unsigned char c) const {
+            std::vector<uint32_t> next;
+            for (auto pc : set) {
+                if (prog.matches(prog.insts[pc], c)) next.push_back(pc + 1);
+            }
+            return closure(std::move(next));
+        }
+
+        bool accepts(const std::vector<uint32_t>& set) const {
+            return std::any_of(set.begin(), set.end(), [&](auto pc) {
+                return prog.insts[pc].op == Op::Match;
+            });
+        }
+
+        size_t stateCount() const {
+            return sets.size();
+        }
+
+        size_t memoryUsage() const {
+            return memoryUsed;
+        }
+
+    private:
+        std::array<uint8_t, 256> byteClasses{};
+        size_t stride = 0;
+
+        // table[state + byteClass] is the premultiplied id of the next state
+        std::vector<uint32_t> table;
+        std::vector<std::vector<uint32_t>> sets;
+        std::vector<bool> accepting;
+        std::vector<std::vector<uint32_t>> matchIds;
+        std::map<std::vector<uint32_t>, uint32_t> ids;
+        size_t memoryUsed = 0;
+        uint32_t start = Unknown;
+        bool counted;
+        // id of the state that was being left when the cache got cleared
+        uint32_t rebuilt = Unknown;
+
+        // bytes that no instruction distinguishes share a class, which shrinks each table row
+        void computeByteClasses() {
+            std::array<bool, 257> boundary{};
+
+            for (auto& inst : prog.insts) {
+                if (inst.op == Op::Char) {
+                    auto c = (unsigned char) inst.c;
+                    boundary[c] = true;
+                    boundary[c + 1] = true;
+                }
+                else if (inst.op == Op::Class) {
+                    auto& set = prog.classes[inst.x];
+                    for (unsigned c = 1; c < 256; c++) {
+                        if (set.contains(c) != set.contains(c - 1)) boundary[c] = true;
+                    }
+                }
+            }
+
+            uint8_t cls = 0;
+            for (unsigned c = 0; c < 256; c++) {
+                if (c > 0 && boundary[c]) cls++;
+                byteClasses[c] = cls;
+            }
+            stride = cls + 1;
+        }
+
+        void clearCache() {
+            table.clear();
+            sets.clear();
+            accepting.clear();
+            matchIds.clear();
+            ids.clear();
+            memoryUsed = 0;
+            start = Unknown;
+
+            addState({});
+            std::fill(table.begin(), table.end(), Dead);
+        }
+
+        uint32_t addState(std::vector<uint32_t> set) {
+            if (auto it = ids.find(set); it != ids.end()) return it->second;
+
+            uint32_t id = table.size();
+            std::vector<uint32_t> matched;
+            for (auto pc : set) {
+                if (prog.insts[pc].op == Op::Match) matched.push_back(prog.insts[pc].x);
+            }
+
+            memoryUsed += (stride + 2 * set.size() + matched.size()) * sizeof(uint32_t) + 64;
+            table.resize(table.size() + stride, Unknown);
+            accepting.push_back(!matched.empty());
+            matchIds.push_back(std::move(matched));
+            ids.emplace(set, id);
+            sets.push_back(std::move(set));
+
+            return id;
+        }
+
+        // plain NFA simulation, slow but bounded in memory
+        void collectWithoutCache(std::string_view source, bool atEnd, std::vector<bool>& matched) const {
+            PikeVM::Scratch s;
+            PikeVM(prog).simulate(source, s, [&](size_t pos, uint32_t pc) {
+                if (!atEnd || pos == source.size()) matched[prog.insts[pc].x] = true;
+                return false;
+            });
+        }
+
+        // transition of state on c for a scan that started at clearsBefore cache clears, Unknown once the scan
+        // cleared the cache more than clearLimit times
+        uint32_t advance(uint32_t state, unsigned char c, size_t clearsBefore) {
+            auto next = table[state + byteClasses[c]];
+            return next != Unknown ? next : fill(state, c, clearsBefore);
+        }
+
+        // the rest of advance, kept apart so the cached lookup stays small where it is inlined
+        uint32_t fill(uint32_t state, unsigned char c, size_t clearsBefore) {
+            auto next = computeNext(state, c);
+            if (next != Unknown || cacheClears - clearsBefore > clearLimit) return next;
+            // state was rebuilt in the new cache, cant be Unknown twice in a row
+            return computeNext(rebuilt, c);
+        }
+
+        // fills in the transition of state on byte c, returns Unknown after clearing a full cache
+        uint32_t computeNext(uint32_t state, unsigned char c) {
+            auto set = step(sets[state / stride], c);
+
+            // the dead state and the rebuilt one always fit, even below the limit
+            if (!ids.contains(set) && memoryUsed >= memoryLimit && sets.size() > 2) {
+                auto current = std::move(sets[state / stride]);
+                cacheClears++;
+                clearCache();
+                rebuilt = addState(std::move(current));
+                return Unknown;
+            }
+
+            auto id = addState(std::move(set));
+            table[state + byteClasses[c]] = id;
+            return id;
+        }
+    };
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace regix {
+    // finds the earliest occurrence of any of up to 8 literals, Teddy style
+    // each literal is a bucket bit, for the first fingerprint bytes two tables indexed by the low and the high
+    // nibble hold the buckets whose literal can have that nibble there, so a pshufb per table and an and over the
+    // fingerprint give the candidate buckets of 16 positions at once, candidates are then checked with memcmp
+    struct Teddy {
+        static constexpr size_t maxLiterals = 8;
+        static constexpr size_t npos = std::string_view::npos;
+
+        std::vector<std::string> literals;
+        size_t width = 0;
+        alignas(16) uint8_t low[3][16]{};
+        alignas(16) uint8_t high[3][16]{};
+
+        Teddy() = default;
+
+        // literals must be non empty
+        explicit Teddy(std::vector<std::string> lits): literals(std::move(lits)) {
+            width = 3;
+            for (auto& lit : literals) {
+                width = std::min(width, lit.size());
+            }
+
+            for (size_t b = 0; b < literals.size(); b++) {
+                for (size_t k = 0; k < width; k++) {
+                    auto c = (unsigned char) literals[b][k];
+                    low[k][c & 15] |= 1 << b;
+                    high[k][c >> 4] |= 1 << b;
+                }
+            }
+        }
+
+        // start of the earliest occurrence at or after from
+        size_t find(std::string_view source, size_t from) const {
+            if (from > source.size()) return npos;
+
+#if defined(__x86_64__)
+            static const bool sse42 = __builtin_cpu_supports("sse4.2");
+            if (sse42) return findSse42(source, from);
+#endif
+            return findScalar(source, from, source.size());
+        }
+
+    private:
+        uint8_t buckets(const char* at) const {
+            uint8_t res = 0xff;
+            for (size_t k = 0; k < width; k++) {
+                auto c = (unsigned char) at[k];
+                res &= low[k][c & 15] & high[k][c >> 4];
+            }
+            return res;
+        }
+
+        bool verify(std::string_view source, size_t at, uint8_t candidates) const {
+            while (candidates) {
+                auto& lit = literals[__builtin_ctz(candidates)];
+                candidates &= candidates - 1;
+
+                if (source.size() - at >= lit.size() && memcmp(source.data() + at, lit.data(), lit.size()) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // positions from..to, reading width bytes past each while they exist
+        size_t findScalar(std::string_view source, size_t from, size_t to) const {
+            for (auto i = from; i < to && i + width <= source.size(); i++) {
+                auto candidates = buckets(source.data() + i);
+                if (candidates && verify(source, i, candidates)) return i;
+            }
+            return npos;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2")))
+        size_t findSse42(std::string_view source, size_t from) const {
+            auto data = source.data();
+            auto nibble = _mm_set1_epi8(0x0f);
+            __m128i lowTable[3], highTable[3];
+            for (size_t k = 0; k < width; k++) {
+                lowTable[k] = _mm_load_si128((const __m128i*) low[k]);
+                highTable[k] = _mm_load_si128((const __m128i*) high[k]);
+            }
+
+            auto i = from;
+            // every load of the fingerprint has to stay inside the source
+            for (; i + 16 + width - 1 <= source.size(); i += 16) {
+                auto res = _mm_set1_epi8(-1);
+                for (size_t k = 0; k < width; k++) {
+                    auto v = _mm_loadu_si128((const __m128i*) (data + i + k));
+                    auto lo = _mm_shuffle_epi8(lowTable[k], _mm_and_si128(v, nibble));
+                    auto hi = _mm_shuffle_epi8(highTable[k], _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+                    res = _mm_and_si128(res, _mm_and_si128(lo, hi));
+                }
+
+                uint32_t hits = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xffff;
+                if (!hits) continue;
+
+                alignas(16) uint8_t candidates[16];
+                _mm_store_si128((__m128i*) candidates, res);
+                while (hits) {
+                    auto j = __builtin_ctz(hits);
+                    hits &= hits - 1;
+                    if (verify(source, i + j, candidates[j])) return i + j;
+                }
+            }
+
+            return findScalar(source, i, source.size());
+        }
+#endif
+    };
+
+    // Aho-Corasick automaton over any number of literals, a flat transition table with failure links folded in
+    // bytes that appear in no literal share one class, which keeps rows short
+    struct AhoCorasick {
+        static constexpr size_t npos = std::string_view::npos;
+
+        AhoCorasick() = default;
+
+        explicit AhoCorasick(const std::vector<std::string>& literals) {
+            uint16_t count = 1;
+            for (auto& lit : literals) {
+                for (unsigned char c : lit) {
+                    if (!classes[c]) classes[c] = count++;
+                }
+            }
+            stride = count;
+
+            // trie, then breadth first to fill in failure transitions
+            addState();
+            for (auto& lit : literals) {
+                uint32_t state = 0;
+                for (unsigned char c : lit) {
+                    auto at = state * stride + classes[c];
+                    // adding a state grows the table, so no reference into it is held
+                    if (!table[at]) {
+                        auto next = addState();
+                        table[at] = next;
+                    }
+                    state = table[at];
+                }
+                longest[state] = std::max<uint32_t>(longest[state], lit.size());
+                maxLength = std::max(maxLength, lit.size());
+            }
+
+            std::vector<uint32_t> fail(longest.size()), queue;
+            for (size_t cls = 0; cls < stride; cls++) {
+                if (auto next = table[cls]) queue.push_back(next);
+            }
+            for (size_t i = 0; i < queue.size(); i++) {
+                auto state = queue[i];
+                longest[state] = std::max(longest[state], longest[fail[state]]);
+
+                for (size_t cls = 0; cls < stride; cls++) {
+                    auto& next = table[state * stride + cls];
+                    if (next) {
+                        fail[next] = table[fail[state] * stride + cls];
+                        queue.push_back(next);
+                    }
+                    else {
+                        next = table[fail[state] * stride + cls];
+                    }
+                }
+            }
+        }
+
+        // start of the earliest occurrence at or after from, the scan goes on past the first end found until
+        // no longer literal could still start before the best start
+        size_t find(std::string_view source, size_t from) const {
+            size_t best = npos;
+            uint32_t state = 0;
+
+            for (auto i = from; i < source.size(); i++) {
+                if (best != npos && i >= best + maxLength) break;
+
+                state = table[state * stride + classes[(unsigned char) source[i]]];
+                if (longest[state]) best = std::min(best, i + 1 - longest[state]);
+            }
+            return best;
+        }
+
+        size_t memoryUsage() const {
+            return (table.size() + longest.size()) * sizeof(uint32_t);
+        }
+
+    private:
+        std::array<uint16_t, 256> classes{};
+        size_t stride = 1;
+        std::vector<uint32_t> table;
+        // length of the longest literal ending in each state
+        std::vector<uint32_t> longest;
+        size_t maxLength = 0;
+
+        uint32_t addState() {
+            table.resize(table.size() + stride, 0);
+            longest.push_back(0);
+            return longest.size() - 1;
+        }
+    };
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+
+#include "PikeVM.h"
+#include "LazyDFA.h"
+#include "Backtrack.h"
+
+namespace regix {
+    // scratch of every engine for one pattern, sized once from the program so matching with a warm context
+    // does not allocate, a context must not be shared between threads
+    struct MatchContext {
+        // capture groups of the last successful match, groups that did not participate are empty with no data
+        std::vector<std::string_view> groups;
+        std::vector<long> slots;
+        PikeVM::Scratch pike;
+        Backtrack::Scratch backtrack;
+        LazyDFA dfa;
+        // limits every call made with this context, unlimited unless set
+        Budget budget;
+
+        explicit MatchContext(const Program& prog): groups(prog.captureCount), slots(prog.slotCount()), dfa(prog) {
+            pike.prepare(prog.insts.size(), prog.slotCount());
+            backtrack.prepare(Backtrack::maxVisited, prog.slotCount());
+            backtrack.stack.reserve(prog.insts.size() + 2 * prog.slotCount());
+        }
+    };
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include "LazyDFA.h"
+
+namespace regix {
+    // scans one huge buffer on several threads by cutting it into chunks, the DFA state at the start of a chunk
+    // is only known once the previous chunk is done, so every worker guesses it to be the unanchored start state
+    // the real state always holds the guessed one, so the two usually collapse into the same state after a few bytes
+    // and the stitch pass only replays a chunk up to that point, from then on the worker's results are exact
+    struct ParallelScan {
+        size_t threads;
+        // buffers below this size per thread are not worth splitting
+        size_t minChunk;
+        // cache size of each worker's DFA
+        size_t memoryLimit = 1 << 20;
+
+        explicit ParallelScan(const Program& prog, size_t threads = std::thread::hardware_concurrency(),
+                              size_t minChunk = 1 << 20):
+            threads(std::max<size_t>(threads, 1)), minChunk(std::max<size_t>(minChunk, 1)), prog(unanchored(prog)) {}
+
+        // whether the pattern matches anywhere in source
+        bool contains(std::string_view source) const {
+            return scan(source, true) > 0;
+        }
+
+        // number of lines of source the pattern matches somewhere in, lines end at '\n' and a last line without
+        // one counts unless it is empty
+        // chunks are cut right after a '\n', so every line is scanned by one worker from the start state and there
+        // is no guessed state to stitch, the counts of the chunks are just added up
+        size_t countMatchingLines(std::string_view source) const {
+            auto chunkCount = std::clamp<size_t>(source.size() / minChunk, 1, threads);
+
+            std::vector<std::string_view> chunks;
+            for (size_t i = 1, from = 0; i <= chunkCount && from < source.size(); i++) {
+                auto to = std::max(from, source.size() / chunkCount * i);
+                auto after = (const char*) memchr(source.data() + to, '\n', source.size() - to);
+                to = after && i < chunkCount ? after - source.data() + 1 : source.size();
+                chunks.push_back(source.substr(from, to - from));
+                from = to;
+            }
+
+            std::vector<size_t> counts(chunks.size());
+            auto work = [&](size_t i) {
+                counts[i] = matchingLines(chunks[i]);
+            };
+
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < chunks.size(); i++) {
+                workers.emplace_back(work, i);
+            }
+            if (!chunks.empty()) work(0);
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            size_t total = 0;
+            for (auto count : counts) {
+                total += count;
+            }
+            return total;
+        }
+
+    private:
+        struct Chunk {
+            std::string_view data;
+            // accepting positions after each byte, walked from the guessed start state
+            size_t count = 0;
+            // NFA set reached at the end of the chunk
+            std::vector<uint32_t> end;
+            bool ok = true;
+        };
+
+        Program prog;
+
+        size_t scan(std::string_view source, bool stopAtMatch) const {
+            LazyDFA dfa(prog, memoryLimit);
+            if (!dfa.supported()) return simulate(source, stopAtMatch);
+
+            size_t total = dfa.isAccepting(dfa.startState());
+            if (stopAtMatch && total) return total;
+
+            auto chunkCount = std::clamp<size_t>(source.size() / minChunk, 1, threads);
+            auto chunkSize = source.size() / chunkCount;
+
+            std::vector<Chunk> chunks(chunkCount);
+            for (size_t i = 0; i < chunkCount; i++) {
+                auto from = i * chunkSize;
+                chunks[i].data = source.substr(from, i + 1 == chunkCount ? std::string_view::npos : chunkSize);
+            }
+
+            std::atomic<bool> found = false;
+            auto work = [&](Chunk& chunk) {
+                LazyDFA local(prog, memoryLimit);
+                auto state = local.startState();
+
+                // walked in blocks so a match found by another worker stops this one early
+                for (size_t at = 0; at < chunk.data.size() && !(stopAtMatch && found); at += 1 << 16) {
+                    auto res = local.walk(state, chunk.data.substr(at, 1 << 16), chunk.count, stopAtMatch);
+                    if (!res) {
+                        chunk.ok = false;
+                        return;
+                    }
+                    state = *res;
+                    if (stopAtMatch && chunk.count) {
+                        found = true;
+                        return;
+                    }
+                }
+                chunk.end = local.setOf(state);
+            };
+
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < chunkCount; i++) {
+                workers.emplace_back(work, std::ref(chunks[i]));
+            }
+            work(chunks[0]);
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            // a match seen from the guessed state is a real one, the real state holds every thread of it
+            if (stopAtMatch && found) return 1;
+
+            // the first chunk started from the real state, the others are replayed until they meet the guess
+            auto real = dfa.closure({0});
+            for (size_t i = 0; i < chunkCount; i++) {
+                auto& chunk = chunks[i];
+                if (i == 0 && chunk.ok) {
+                    total += chunk.count;
+                    real = std::move(chunk.end);
+                    continue;
+                }
+
+                size_t count = 0;
+                if (!stitch(dfa, chunk, real, count, stopAtMatch)) stitchWithoutCache(dfa, chunk, real, count, stopAtMatch);
+                total += count;
+                if (stopAtMatch && total) return total;
+            }
+
+            return total;
+        }
+
+        // a program the DFA opted out of runs on one thread, the unanchored program has a single Match
+        size_t simulate(std::string_view source, bool stopAtMatch) const {
+            size_t total = 0;
+            PikeVM::Scratch s;
+            PikeVM(prog).simulate(source, s, [&](size_t pos, uint32_t pc) {
+                total++;
+                return stopAtMatch;
+            });
+            return total;
+        }
+
+        // matching lines of data, which holds whole lines
+        size_t matchingLines(std::string_view data) const {
+            LazyDFA dfa(prog, memoryLimit);
+            PikeVM::Scratch scratch;
+            size_t total = 0;
+
+            while (!data.empty()) {
+                auto after = (const char*) memchr(data.data(), '\n', data.size());
+                auto stop = after ? after - data.data() : data.size();
+                total += lineMatches(dfa, scratch, data.substr(0, stop));
+                data.remove_prefix(after ? stop + 1 : stop);
+            }
+            return total;
+        }
+
+        // the DFA walks the line from the start state and stops at the first accepting position, a program it
+        // opted out of or a cache that thrashes runs on the NFA instead
+        bool lineMatches(LazyDFA& dfa, PikeVM::Scratch& scratch, std::string_view line) const {
+            if (dfa.supported()) {
+                auto state = dfa.startState();
+                if (dfa.isAccepting(state)) return true;
+
+                size_t count = 0;
+                if (dfa.walk(state, line, count, true)) return count > 0;
+            }
+
+            bool found = false;
+            PikeVM(prog).simulate(line, scratch, [&](size_t pos, uint32_t pc) {
+                found = true;
+                return true;
+            });
+            return found;
+        }
+
+        // replays chunk from the real state next to the guessed one until both are the same state, false when
+        // the cache got cleared on the way since state ids cant be compared across clears
+        bool stitch(LazyDFA& dfa, const Chunk& chunk, std::vector<uint32_t>& real, size_t& count,
+                    bool stopAtMatch) const {
+            size_t clearsBefore = dfa.cacheClears;
+            auto state = dfa.stateOf(real);
+            auto guess = dfa.startState();
+            // accepting positions seen by the guess so far, they are already part of chunk.count
+            size_t guessed = 0;
+
+            for (size_t i = 0; i < chunk.data.size(); i++) {
+                if (chunk.ok && state == guess) break;
+
+                unsigned char c = chunk.data[i];
+                state = dfa.next(state, c);
+                if (dfa.cacheClears != clearsBefore) return false;
+                guess = dfa.next(guess, c);
+                if (dfa.cacheClears != clearsBefore) return false;
+
+                if (dfa.isAccepting(state)) {
+                    count++;
+                    if (stopAtMatch) return true;
+                }
+                guessed += dfa.isAccepting(guess);
+
+                if (i + 1 == chunk.data.size()) {
+                    real = dfa.setOf(state);
+                    return true;
+                }
+            }
+
+            if (chunk.data.empty()) return true;
+            count += chunk.count - guessed;
+            real = chunk.end;
+            return true;
+        }
+
+        // same replay on NFA sets, used when the stitch DFA thrashes
+        void stitchWithoutCache(const LazyDFA& dfa, const Chunk& chunk, std::vector<uint32_t>& real, size_t& count,
+                                bool stopAtMatch) const {
+            auto guess = dfa.closure({0});
+            size_t guessed = 0;
+            count = 0;
+
+            for (unsigned char c : chunk.data) {
+                if (chunk.ok && real == guess) {
+                    count += chunk.count - guessed;
+                    real = chunk.end;
+                    return;
+                }
+
+                real = dfa.step(real, c);
+                guess = dfa.step(guess, c);
+                if (dfa.accepts(real)) {
+                    count++;
+                    if (stopAtMatch) return;
+                }
+                guessed += dfa.accepts(guess);
+            }
+        }
+    };
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+
+#include "Regix.h"
+#include "MatchContext.h"
+#include "Jit.h"
+#include "BitNFA.h"
+
+namespace regix {
+    // compiled form of a pattern, owns only the flat program so the node tree can be dropped after lowering
+    // match and search pick the backtracker when its visited bitmap is small enough and the PikeVM otherwise,
+    // doesMatch with a context goes through the lazy DFA kept in that context, or through native code when the
+    // pattern was compiled with jit and its DFA was small enough to be emitted
+    // small patterns also get a bit-parallel NFA, which runs doesMatch without a context and contains without
+    // allocating anything
+    // a pattern is immutable, the overloads taking a MatchContext are the allocation free ones for hot loops
+    // and the ones honoring ctx.budget, match then returns Budget::Exceeded when it runs out while doesMatch
+    // and search report no match and leave ctx.budget.exceeded() set
+    struct Pattern {
+        const Program prog;
+        const Prefilter prefilter;
+        // full match in native code, nullptr when not requested or not possible
+        const std::unique_ptr<const JitCode> native;
+        // nullptr when the program has too many positions
+        const std::unique_ptr<const BitNFA> bits;
+
+        explicit Pattern(Program prog, bool jit = false):
+            prog(std::move(prog)), prefilter(Prefilter::fromProgram(this->prog)),
+            native(jit ? JitCode::compile(this->prog) : nullptr), bits(BitNFA::compile(this->prog)) {}
+
+        // with a prefilter saved along with the program
+        Pattern(Program prog, Prefilter prefilter, bool jit = false):
+            prog(std::move(prog)), prefilter(std::move(prefilter)),
+            native(jit ? JitCode::compile(this->prog) : nullptr), bits(BitNFA::compile(this->prog)) {}
+
+        Pattern(const Pattern&) = delete;
+        Pattern& operator=(const Pattern&) = delete;
+
+        MatchContext context() const {
+            return MatchContext(prog);
+        }
+
+        long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches) const {
+            std::vector<long> slots(prog.slotCount(), -1);
+            PikeVM::Scratch pike;
+            Backtrack::Scratch backtrack;
+
+            auto res = run(source, false, slots, pike, backtrack);
+            if (res < 0) return -1;
+
+            prog.collectCaptures(source, slots, matches);
+            return res;
+        }
+
+        // captures end up in ctx.groups
+        long match(std::string_view source, MatchContext& ctx) const {
+            ctx.slots.assign(prog.slotCount(), -1);
+
+            auto res = run(source, false, ctx.slots, ctx.pike, ctx.backtrack, ctx.budget.begin());
+            if (res < 0) return res;
+
+            prog.collectCaptures(source, ctx.slots, ctx.groups);
+            return res;
+        }
+
+        bool doesMatch(std::string_view source) const {
+            if (native) return native->doesMatch(source);
+            if (bits) return bits->doesMatch(source);
+
+            std::vector<long> slots;
+            PikeVM::Scratch pike;
+            Backtrack::Scratch backtrack;
+
+            return run(source, true, slots, pike, backtrack) >= 0;
+        }
+
+        bool doesMatch(std::string_view source, MatchContext& ctx) const {
+            auto budget = ctx.budget.begin();
+            // native code is not metered, a limited call stays on the DFA
+            if (native && !budget) return native->doesMatch(source);
+            return ctx.dfa.doesMatch(source, budget);
+        }
+
+        // full match of a column of rows kept as one data buffer and rows + 1 offsets, the layout of Arrow strings
+        // bit i of selection is set when row i matches, selection needs (rows + 63) / 64 words
+        template<class Offset>
+        void doesMatchColumn(const char* data, const Offset* offsets, size_t rows, uint64_t* selection,
+                             MatchContext& ctx) const {
+            std::fill(selection, selection + (rows + 63) / 64, 0);
+            ctx.dfa.doesMatchRows(data, offsets, rows, [&](size_t i) {
+                selection[i / 64] |= uint64_t(1) << (i % 64);
+            });
+        }
+
+        // indices of the matching rows in ascending order
+        template<class Offset>
+        void doesMatchColumn(const char* data, const Offset* offsets, size_t rows, std::vector<uint32_t>& indices,
+                             MatchContext& ctx) const {
+            indices.clear();
+            ctx.dfa.doesMatchRows(data, offsets, rows, [&](size_t i) {
+                indices.push_back(i);
+            });
+        }
+
+        // leftmost-first match anywhere in source
+        // only the scratch of the engine that runs is sized, to the input, unlike a whole context with its DFA
+        std::optional<std::string_view> search(std::string_view source) const {
+            std::vector<long> slots(2, -1);
+            PikeVM::Scratch pike;
+            Backtrack::Scratch backtrack;
+
+            auto end = find(source, slots, pike, backtrack);
+            if (end < 0) return std::nullopt;
+
+            return source.substr(slots[0], end - slots[0]);
+        }
+
+        std::optional<std::string_view> search(std::string_view source, MatchContext& ctx) const {
+            ctx.slots.assign(2, -1);
+
+            auto end = find(source, ctx.slots, ctx.pike, ctx.backtrack, ctx.budget.begin());
+            if (end < 0) return std::nullopt;
+
+            return source.substr(ctx.slots[0], end - ctx.slots[0]);
+        }
+
+        // whether the pattern matches anywhere in source, the same as search having a result
+        bool contains(std::string_view source) const {
+            if (bits) return bits->contains(source, &prefilter);
+            return search(source).has_value();
+        }
+
+        // successive non-overlapping matches, an empty match moves the next search one byte further
+        std::vector<std::string_view> findAll(std::string_view source) const {
+            auto ctx = context();
+            std::vector<std::string_view> res;
+
+            size_t pos = 0;
+            while (pos <= source.size()) {
+                auto found = search(source.substr(pos), ctx);
+                if (!found) break;
+
+                res.push_back(*found);
+                auto start = found->data() - source.data();
+                pos = start + found->size() + (found->empty() ? 1 : 0);
+            }
+
+            return res;
+        }
+
+        void print() const {
+            prog.print();
+        }
+
+        size_t memoryUsage() const {
+            return prog.memoryUsage() + prefilter.memoryUsage() + (native ? native->codeSize() : 0) +
+                   (bits ? bits->memoryUsage() : 0);
+        }
+
+    private:
+        long run(std::string_view source, bool fullMatch, std::vector<long>& slots,
+                 PikeVM::Scratch& pike, Backtrack::Scratch& backtrack, Budget* budget = nullptr) const {
+            Backtrack bt(prog);
+            if (bt.fits(source)) return bt.run(source, fullMatch, slots, backtrack, budget);
+
+            return PikeVM(prog).run(source, fullMatch, slots, pike, budget);
+        }
+
+        long find(std::string_view source, std::vector<long>& slots, PikeVM::Scratch& pike,
+                  Backtrack::Scratch& backtrack, Budget* budget = nullptr) const {
+            Backtrack bt(prog);
+            if (bt.fits(source)) return bt.search(source, prefilter, slots, backtrack, budget);
+
+            return PikeVM(prog).search(source, prefilter, slots, pike, budget);
+        }
+    };
+
+    // returns nullptr when the pattern is malformed or uses a construct without a flat form
+    // jit asks for native code for doesMatch, patterns without one silently keep the interpreters
+    std::unique_ptr<Pattern> compile(std::string_view str, bool jit = false) {
+        auto tree = constructRegix(str);
+        if (!tree) return nullptr;
+
+        auto prog = compileProgram(*tree);
+        if (!prog) return nullptr;
+
+        return std::make_unique<Pattern>(std::move(*prog), jit);
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+
+#include "Pattern.h"
+
+namespace regix {
+    // compiled patterns keyed by their text and shared between threads, patterns are immutable so callers
+    // only need their own MatchContext
+    // keys are spread over shards that each have their own lock, LRU list and share of the byte capacity
+    struct PatternCache {
+        struct Stats {
+            size_t hits;
+            size_t misses;
+            size_t evictions;
+            size_t entries;
+            size_t bytes;
+        };
+
+        explicit PatternCache(size_t capacity = 64 << 20, size_t shardCount = 16):
+            shardCapacity(capacity / shardCount), shards(shardCount) {}
+
+        PatternCache(const PatternCache&) = delete;
+        PatternCache& operator=(const PatternCache&) = delete;
+
+        static PatternCache& global() {
+            static PatternCache cache;
+            return cache;
+        }
+
+        // nullptr when the pattern does not compile, failures are not cached
+        std::shared_ptr<const Pattern> get(std::string_view str) {
+            auto& shard = shards[std::hash<std::string_view>()(str) % shards.size()];
+
+            {
+                std::lock_guard guard(shard.lock);
+                if (auto it = shard.index.find(str); it != shard.index.end()) {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    hits++;
+                    return it->second->pattern;
+                }
+            }
+
+            // compiling happens outside of the lock, a racing thread may insert the same key first
+            misses++;
+            std::shared_ptr<const Pattern> pattern = compile(str);
+            if (!pattern) return nullptr;
+
+            std::lock_guard guard(shard.lock);
+            if (auto it = shard.index.find(str); it != shard.index.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return it->second->pattern;
+            }
+
+            auto size = pattern->memoryUsage() + str.size();
+            shard.lru.push_front({std::string(str), pattern, size});
+            shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+            shard.bytes += size;
+
+            // the newest entry stays even when it alone is over capacity
+            while (shard.bytes > shardCapacity && shard.lru.size() > 1) {
+                auto& last = shard.lru.back();
+                shard.bytes -= last.size;
+                shard.index.erase(last.key);
+                shard.lru.pop_back();
+                evictions++;
+            }
+
+            return pattern;
+        }
+
+        Stats stats() {
+            Stats res{hits, misses, evictions, 0, 0};
+            for (auto& shard : shards) {
+                std::lock_guard guard(shard.lock);
+                res.entries += shard.lru.size();
+                res.bytes += shard.bytes;
+            }
+            return res;
+        }
+
+        void clear() {
+            for (auto& shard : shards) {
+                std::lock_guard guard(shard.lock);
+                shard.index.clear();
+                shard.lru.clear();
+                shard.bytes = 0;
+            }
+        }
+
+    private:
+        struct Entry {
+            std::string key;
+            std::shared_ptr<const Pattern> pattern;
+            size_t size;
+        };
+
+        struct Shard {
+            std::mutex lock;
+            // most recently used first
+            std::list<Entry> lru;
+            // keys view the strings owned by lru entries
+            std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+            size_t bytes = 0;
+        };
+
+        size_t shardCapacity;
+        std::vector<Shard> shards;
+        std::atomic<size_t> hits = 0;
+        std::atomic<size_t> misses = 0;
+        std::atomic<size_t> evictions = 0;
+    };
+}
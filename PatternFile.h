@@ -0,0 +1,333 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Pattern.h"
+
+namespace regix {
+    static_assert(offsetof(Inst, c) == 1 && offsetof(Inst, x) == 4 && sizeof(CharSet) == 32);
+    static_assert(sizeof(Counter) == 12);
+
+    // compiled patterns saved to one file that is mapped read only and used in place, so a process starts
+    // without parsing or lowering and every process on a host shares the page cache copy
+    // every entry holds the program, the prefilter literals and, when its DFA has few enough states, the whole
+    // transition table, doesMatch then runs on the mapped table without building anything
+    // sections are found by offsets from the start of the file and aligned to 8, values are in native byte order
+    // only the framing is checked when opening, the contents are trusted to come from save
+    struct PatternFile {
+        static constexpr char magic[8] = {'R', 'E', 'G', 'I', 'X', 'P', 'A', 'T'};
+        static constexpr uint32_t version = 2;
+
+        // file:  Header, uint64_t offset of every entry, entries
+        // entry: Entry, insts, classes, counters, table, accepting flags, prefix,
+        //        literals as uint32_t length and bytes
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t count;
+            uint64_t size;
+        };
+
+        struct Entry {
+            // no instructions when the pattern had no compiled form
+            uint32_t insts;
+            uint32_t classes;
+            uint32_t captures;
+            uint32_t emptyMatch;
+            // states of the table including the dead one at 0 and the start at 1, 0 when there is no table
+            uint32_t states;
+            uint32_t stride;
+            uint32_t prefix;
+            uint32_t literals;
+            uint32_t counters;
+            uint32_t reserved;
+            CharSet first;
+            uint8_t byteClasses[256];
+        };
+
+        // one saved pattern, pointers into the mapping
+        struct Image {
+            const Entry* entry = nullptr;
+            const Inst* insts = nullptr;
+            const CharSet* classes = nullptr;
+            const Counter* counters = nullptr;
+            // table[state + byteClass] is the premultiplied next state, like in LazyDFA
+            const uint32_t* table = nullptr;
+            const uint8_t* accepting = nullptr;
+            std::string_view prefix;
+            const char* literals = nullptr;
+
+            bool compiled() const {
+                return entry->insts > 0;
+            }
+
+            bool hasTable() const {
+                return entry->states > 0;
+            }
+
+            // full match on the saved table, nullopt when the entry has none
+            std::optional<bool> tryDoesMatch(std::string_view source) const {
+                if (!hasTable()) return std::nullopt;
+
+                auto stride = entry->stride;
+                uint32_t state = stride;
+                for (unsigned char c : source) {
+                    state = table[state + entry->byteClasses[c]];
+                    if (state == 0) return false;
+                }
+                return accepting[state / stride] != 0;
+            }
+
+            // copies the program and prefilter out of the mapping, nullptr when the pattern had no compiled form
+            std::unique_ptr<Pattern> load(bool jit = false) const {
+                if (!compiled()) return nullptr;
+
+                Program prog;
+                prog.insts.assign(insts, insts + entry->insts);
+                prog.classes.assign(classes, classes + entry->classes);
+                for (auto& set : prog.classes) {
+                    prog.spans.emplace_back(set);
+                }
+                prog.counters.assign(counters, counters + entry->counters);
+                prog.captureCount = entry->captures;
+
+                Prefilter prefilter;
+                prefilter.prefix = prefix;
+                prefilter.first = entry->first;
+                prefilter.emptyMatch = entry->emptyMatch != 0;
+                auto at = literals;
+                for (uint32_t i = 0; i < entry->literals; i++) {
+                    uint32_t len;
+                    memcpy(&len, at, 4);
+                    prefilter.literals.emplace_back(at + 4, len);
+                    at += 4 + len;
+                }
+                prefilter.prepare();
+
+                return std::make_unique<Pattern>(std::move(prog), std::move(prefilter), jit);
+            }
+        };
+
+        // writes patterns in order, a null entry keeps its index and loads as nullptr
+        // the file is written next to path and renamed over it, processes that still map the old one keep it
+        static bool save(const std::string& path, const std::vector<std::unique_ptr<Pattern>>& patterns,
+                         size_t maxStates = 4096) {
+            std::string out(sizeof(Header) + 8 * patterns.size(), '\0');
+
+            for (size_t i = 0; i < patterns.size(); i++) {
+                uint64_t offset = out.size();
+                memcpy(out.data() + sizeof(Header) + 8 * i, &offset, 8);
+                writeEntry(out, patterns[i].get(), maxStates);
+            }
+
+            Header header{};
+            memcpy(header.magic, magic, sizeof(magic));
+            header.version = version;
+            header.count = patterns.size();
+            header.size = out.size();
+            memcpy(out.data(), &header, sizeof(Header));
+
+            auto tmp = path + ".tmp";
+            {
+                std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+                if (!file.write(out.data(), out.size())) return false;
+            }
+            std::error_code error;
+            std::filesystem::rename(tmp, path, error);
+            return !error;
+        }
+
+        // nullptr when the file is missing, of another version or cut short
+        static std::unique_ptr<PatternFile> open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return nullptr;
+
+            struct stat st{};
+            void* addr = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(Header)) {
+                addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            if (addr == MAP_FAILED) return nullptr;
+
+            std::unique_ptr<PatternFile> res(new PatternFile((const char*) addr, st.st_size));
+            if (!res->index()) return nullptr;
+            return res;
+        }
+
+        PatternFile(const PatternFile&) = delete;
+        PatternFile& operator=(const PatternFile&) = delete;
+
+        ~PatternFile() {
+            munmap((void*) data, size);
+        }
+
+        size_t count() const {
+            return images.size();
+        }
+
+        const Image& operator[](size_t i) const {
+            return images[i];
+        }
+
+        size_t mappedSize() const {
+            return size;
+        }
+
+    private:
+        const char* data;
+        size_t size;
+        std::vector<Image> images;
+
+        PatternFile(const char* data, size_t size): data(data), size(size) {}
+
+        static void align(std::string& out) {
+            out.resize((out.size() + 7) & ~size_t(7), '\0');
+        }
+
+        static void append(std::string& out, const void* src, size_t len) {
+            out.append((const char*) src, len);
+        }
+
+        static void writeEntry(std::string& out, const Pattern* pattern, size_t maxStates) {
+            Entry entry{};
+            if (!pattern) {
+                append(out, &entry, sizeof(Entry));
+                return;
+            }
+
+            auto& prog = pattern->prog;
+            auto& prefilter = pattern->prefilter;
+            entry.insts = prog.insts.size();
+            entry.classes = prog.classes.size();
+            entry.captures = prog.captureCount;
+            entry.emptyMatch = prefilter.emptyMatch;
+            entry.prefix = prefilter.prefix.size();
+            entry.literals = prefilter.literals.size();
+            entry.counters = prog.counters.size();
+            entry.first = prefilter.first;
+
+            // the table renumbers the states reachable from the start densely, dead first
+            LazyDFA dfa(prog, 64 << 20);
+            std::vector<uint32_t> table;
+            std::vector<uint8_t> accepting;
+            if (auto order = dfa.reachableStates(maxStates)) {
+                uint32_t stride = dfa.classCount();
+                std::map<uint32_t, uint32_t> index{{LazyDFA::Dead, 0}};
+                for (size_t i = 0; i < order->size(); i++) {
+                    index[(*order)[i]] = (i + 1) * stride;
+                }
+
+                // a byte standing for every class
+                std::vector<unsigned char> sample(stride);
+                for (unsigned c = 256; c-- > 0;) {
+                    sample[dfa.byteClass(c)] = c;
+                }
+
+                table.assign(stride, 0);
+                accepting.push_back(0);
+                for (auto id : *order) {
+                    for (uint32_t k = 0; k < stride; k++) {
+                        table.push_back(index.at(dfa.next(id, sample[k])));
+                    }
+                    accepting.push_back(dfa.isAccepting(id));
+                }
+
+                entry.states = accepting.size();
+                entry.stride = stride;
+                for (unsigned c = 0; c < 256; c++) {
+                    entry.byteClasses[c] = dfa.byteClass(c);
+                }
+            }
+
+            append(out, &entry, sizeof(Entry));
+            for (auto& inst : prog.insts) {
+                // field by field so the padding is written as zeros
+                uint8_t raw[sizeof(Inst)]{};
+                raw[0] = (uint8_t) inst.op;
+                raw[1] = inst.c;
+                memcpy(raw + 4, &inst.x, 4);
+                append(out, raw, sizeof(raw));
+            }
+            append(out, prog.classes.data(), prog.classes.size() * sizeof(CharSet));
+            append(out, prog.counters.data(), prog.counters.size() * sizeof(Counter));
+            append(out, table.data(), table.size() * 4);
+            append(out, accepting.data(), accepting.size());
+            align(out);
+            append(out, prefilter.prefix.data(), prefilter.prefix.size());
+            for (auto& lit : prefilter.literals) {
+                uint32_t len = lit.size();
+                append(out, &len, 4);
+                append(out, lit.data(), len);
+            }
+            align(out);
+        }
+
+        // points every image into the mapping, false when a section runs past the end of the file
+        bool index() {
+            Header header;
+            memcpy(&header, data, sizeof(Header));
+            if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.size != size) {
+                return false;
+            }
+            if ((size - sizeof(Header)) / 8 < header.count) return false;
+
+            images.resize(header.count);
+            for (size_t i = 0; i < header.count; i++) {
+                uint64_t at;
+                memcpy(&at, data + sizeof(Header) + 8 * i, 8);
+                if (at % 8 != 0 || at > size || size - at < sizeof(Entry)) return false;
+
+                auto& image = images[i];
+                image.entry = (const Entry*) (data + at);
+                auto& entry = *image.entry;
+                at += sizeof(Entry);
+
+                // sections are sized from 32 bit counts, so none of these sums can overflow
+                auto take = [&](uint64_t len) -> const char* {
+                    if (at > size || size - at < len) return nullptr;
+                    auto res = data + at;
+                    at += len;
+                    return res;
+                };
+                uint64_t tableSize = (uint64_t) entry.states * entry.stride * 4;
+                image.insts = (const Inst*) take((uint64_t) entry.insts * sizeof(Inst));
+                image.classes = (const CharSet*) take((uint64_t) entry.classes * sizeof(CharSet));
+                image.counters = (const Counter*) take((uint64_t) entry.counters * sizeof(Counter));
+                image.table = (const uint32_t*) take(tableSize);
+                image.accepting = (const uint8_t*) take(entry.states);
+                at = (at + 7) & ~uint64_t(7);
+                auto prefix = take(entry.prefix);
+                if (!image.insts || !image.classes || !image.counters || !image.table || !image.accepting || !prefix) {
+                    return false;
+                }
+                image.prefix = std::string_view(prefix, entry.prefix);
+
+                image.literals = data + at;
+                for (uint32_t k = 0; k < entry.literals; k++) {
+                    uint32_t len;
+                    auto lenAt = take(4);
+                    if (!lenAt) return false;
+                    memcpy(&len, lenAt, 4);
+                    if (!take(len)) return false;
+                }
+                if (entry.states > 0 && (entry.states < 2 || entry.stride == 0)) return false;
+            }
+            return true;
+        }
+    };
+}
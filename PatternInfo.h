@@ -0,0 +1,285 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+
+#include "Regix.h"
+#include "LazyDFA.h"
+
+namespace regix {
+    // static report on a pattern, meant for vetting patterns that come from untrusted sources before they run
+    // and for picking an engine up front
+    struct PatternInfo {
+        static constexpr size_t unbounded = SIZE_MAX;
+
+        // worst case time of one anchored attempt of the tree as a power of the input length, 1 is linear and
+        // 0 bounded by the pattern alone
+        // the tree never backtracks, but an alternative that scans far before failing is scanned again by every
+        // iteration of an enclosing repeat, ((a*b)|a)* on a run of a is quadratic
+        size_t treeDegree = 1;
+        // the flat engines are linear in the input for every pattern, the backtracker and the PikeVM with a
+        // factor of programSize, the DFA with a constant one but with up to exponentially many states in
+        // programSize, dfaStates counts them and is nullopt past the limit given to analyze
+        // without a flat form, like ^(ab), only the tree can run the pattern and both stay empty
+        size_t programSize = 0;
+        std::optional<size_t> dfaStates;
+
+        // bounds on the length of a match, maxLength is unbounded after a repeat of something non empty
+        size_t minLength = 0;
+        size_t maxLength = 0;
+        // strings every match contains, in pattern order
+        std::vector<std::string> requiredLiterals;
+        size_t captureCount = 0;
+
+        bool matchesEmpty() const {
+            return minLength == 0;
+        }
+
+        // small enough a DFA to be compiled to native code
+        bool jittable() const {
+            return dfaStates && *dfaStates <= 1024;
+        }
+
+        void print() const {
+            std::cout << "tree degree: " << treeDegree << std::endl;
+            std::cout << "program: " << programSize << " dfa states: ";
+            if (dfaStates) std::cout << *dfaStates;
+            else std::cout << (programSize ? "too many" : "none");
+            std::cout << std::endl;
+
+            std::cout << "length: " << minLength << "..";
+            if (maxLength == unbounded) std::cout << "inf";
+            else std::cout << maxLength;
+            std::cout << " captures: " << captureCount << " literals:";
+            for (auto& lit : requiredLiterals) {
+                std::cout << " \"" << lit << '"';
+            }
+            std::cout << std::endl;
+        }
+    };
+
+    namespace analysis {
+        // per node facts gathered bottom up
+        struct Facts {
+            size_t minLength = 0;
+            size_t maxLength = 0;
+            // power of the input length one attempt may cost
+            size_t degree = 0;
+            // power of the work an attempt may scan and then throw away while still succeeding or being
+            // retried, -1 when it never does
+            long waste = -1;
+            size_t captures = 0;
+            // literal runs every match contains, in order, startsWith and endsWith tell whether the first and
+            // last of them touch the edges of the match so neighbours join into one longer literal
+            std::vector<std::string> literals;
+            bool startsWith = false;
+            bool endsWith = false;
+            // matches exactly its single literal
+            bool whole = false;
+        };
+
+        size_t add(size_t x, size_t y) {
+            return x == PatternInfo::unbounded || y == PatternInfo::unbounded ? PatternInfo::unbounded : x + y;
+        }
+
+        size_t mul(size_t x, size_t n) {
+            if (x == 0 || n == 0) return 0;
+            return x == PatternInfo::unbounded || x > PatternInfo::unbounded / n ? PatternInfo::unbounded : x * n;
+        }
+
+        Facts of(Regix& node);
+
+        Facts sequence(NodeList& inner) {
+            Facts res;
+            // the last literal is open while whatever comes next still continues it
+            std::vector<std::string> runs{""};
+
+            for (auto& in : inner) {
+                auto f = of(*in);
+                if (in == inner.front()) res.startsWith = f.startsWith;
+                res.endsWith = f.endsWith;
+                res.minLength = add(res.minLength, f.minLength);
+                res.maxLength = add(res.maxLength, f.maxLength);
+                res.degree = std::max(res.degree, f.degree);
+                res.waste = std::max(res.waste, f.waste);
+                res.captures += f.captures;
+
+                size_t i = 0;
+                if (f.startsWith) {
+                    runs.back() += f.literals[i++];
+                }
+                else {
+                    runs.push_back("");
+                }
+                if (f.whole) continue;
+
+                runs.insert(runs.end(), f.literals.begin() + i, f.literals.end());
+                if (!f.endsWith) runs.push_back("");
+            }
+
+            runs.erase(std::remove(runs.begin(), runs.end(), ""), runs.end());
+            res.whole = res.startsWith && res.endsWith && runs.size() == 1 &&
+                        res.minLength == runs[0].size() && res.maxLength == runs[0].size();
+            res.literals = std::move(runs);
+            return res;
+        }
+
+        Facts single(size_t degree = 0) {
+            Facts res;
+            res.minLength = res.maxLength = 1;
+            res.degree = degree;
+            return res;
+        }
+
+        Facts of(Regix& node) {
+            switch (node.kind) {
+                case Kind::Char: {
+                    auto c = static_cast<Char*>(&node);
+                    auto res = single();
+                    res.literals = {std::string(1, c->c)};
+                    res.startsWith = res.endsWith = res.whole = true;
+                    return res;
+                }
+                case Kind::Literal: {
+                    auto lit = static_cast<Literal*>(&node);
+                    Facts res;
+                    res.minLength = res.maxLength = lit->str.size();
+                    res.literals = {lit->str};
+                    res.startsWith = res.endsWith = res.whole = true;
+                    return res;
+                }
+                case Kind::Any:
+                case Kind::CharClass:
+                    return single();
+                case Kind::Group: {
+                    auto group = static_cast<Group*>(&node);
+                    return sequence(group->inner);
+                }
+                case Kind::Capture: {
+                    auto capture = static_cast<Capture*>(&node);
+                    auto res = sequence(capture->inner);
+                    res.captures++;
+                    return res;
+                }
+                case Kind::XAndMore: {
+                    auto repeat = static_cast<XAndMore*>(&node);
+                    auto inner = of(*repeat->inner);
+
+                    Facts res;
+                    res.minLength = mul(inner.minLength, repeat->amount);
+                    res.maxLength = inner.maxLength ? PatternInfo::unbounded : 0;
+                    res.captures = inner.captures;
+                    // every iteration may redo the waste of the one before, and the last one fails
+                    res.degree = std::max({size_t(1), inner.degree, size_t(inner.waste + 1)});
+                    res.waste = repeat->single ? 0 : std::max<long>(inner.degree, inner.waste);
+                    // a mandatory first iteration brings its literals and the last one touches the end of the match,
+                    // unless that is the same literal, which may then stand for two different iterations
+                    if (repeat->amount > 0) {
+                        res.literals = inner.literals;
+                        res.startsWith = inner.startsWith;
+                        res.endsWith = inner.endsWith && inner.literals.size() > 1;
+                    }
+                    return res;
+                }
+                case Kind::Repeat: {
+                    auto repeat = static_cast<Repeat*>(&node);
+                    auto inner = of(*repeat->inner);
+
+                    Facts res;
+                    res.minLength = mul(inner.minLength, repeat->min);
+                    res.maxLength = mul(inner.maxLength, repeat->max);
+                    res.captures = inner.captures;
+                    // the rounds are bounded, so redoing the waste of each only adds a constant factor
+                    res.degree = std::max<long>(inner.degree, inner.waste);
+                    res.waste = repeat->single ? 0 : std::max<long>(inner.degree, inner.waste);
+                    // a fixed count of a whole literal is that literal written count times, while it stays short
+                    if (inner.whole && repeat->min == repeat->max && res.minLength <= 256) {
+                        std::string lit;
+                        for (size_t i = 0; i < repeat->min; i++) {
+                            lit += inner.literals[0];
+                        }
+                        res.literals = {lit};
+                        res.startsWith = res.endsWith = res.whole = true;
+                    }
+                    else if (repeat->min > 0) {
+                        res.literals = inner.literals;
+                        res.startsWith = inner.startsWith;
+                        res.endsWith = inner.endsWith && inner.literals.size() > 1;
+                    }
+                    return res;
+                }
+                case Kind::Optional: {
+                    auto optional = static_cast<Optional*>(&node);
+                    auto inner = of(*optional->inner);
+                    inner.minLength = 0;
+                    inner.waste = std::max<long>(inner.degree, inner.waste);
+                    inner.literals.clear();
+                    inner.startsWith = inner.endsWith = inner.whole = false;
+                    return inner;
+                }
+                case Kind::Or: {
+                    auto alternation = static_cast<Or*>(&node);
+                    auto left = of(*alternation->left);
+                    auto right = of(*alternation->right);
+
+                    Facts res;
+                    res.minLength = std::min(left.minLength, right.minLength);
+                    res.maxLength = std::max(left.maxLength, right.maxLength);
+                    res.degree = std::max(left.degree, right.degree);
+                    res.waste = std::max({(long) left.degree, left.waste, right.waste});
+                    res.captures = left.captures + right.captures;
+                    return res;
+                }
+                case Kind::Not: {
+                    auto negation = static_cast<Not*>(&node);
+                    auto inner = of(*negation->inner);
+
+                    auto res = single(inner.degree);
+                    res.waste = inner.degree;
+                    res.captures = inner.captures;
+                    return res;
+                }
+            }
+            return {};
+        }
+
+        // states of the full DFA, nullopt when there are more than maxStates or the cache would not hold them
+        std::optional<size_t> dfaStates(const Program& prog, size_t maxStates) {
+            LazyDFA dfa(prog, 64 << 20);
+            auto states = dfa.reachableStates(maxStates);
+            if (!states) return std::nullopt;
+            return states->size();
+        }
+    }
+
+    // report on a parsed tree, the program facts stay empty
+    PatternInfo analyze(Regix& root) {
+        auto facts = analysis::of(root);
+
+        PatternInfo info;
+        info.treeDegree = facts.degree;
+        info.minLength = facts.minLength;
+        info.maxLength = facts.maxLength;
+        info.requiredLiterals = std::move(facts.literals);
+        info.captureCount = facts.captures;
+        return info;
+    }
+
+    // nullopt when the pattern is malformed, counting DFA states stops at maxStates
+    std::optional<PatternInfo> analyze(std::string_view str, size_t maxStates = 4096) {
+        auto tree = constructRegix(str);
+        if (!tree) return std::nullopt;
+
+        auto info = analyze(*tree);
+        if (auto prog = compileProgram(*tree)) {
+            info.programSize = prog->insts.size();
+            info.dfaStates = analysis::dfaStates(*prog, maxStates);
+        }
+        return info;
+    }
+}
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+
+#include "Regix.h"
+#include "Prefilter.h"
+#include "Budget.h"
+
+namespace regix {
+    // threads alive at one position in priority order with O(1) insert, lookup and clear, a thread is the pc it
+    // waits on, except on a Repeat where threads that entered it at different positions have consumed different
+    // counts, those are counted threads numbered from base on and the Repeat pc itself only marks the entry
+    struct ThreadList {
+        struct Counted {
+            uint32_t pc;
+            // bytes of the Repeat consumed so far
+            uint32_t count;
+        };
+
+        std::vector<uint32_t> dense;
+        std::vector<uint32_t> sparse;
+        std::vector<Counted> counted;
+        size_t size = 0;
+        // number of instructions, the first counted thread
+        uint32_t base = 0;
+
+        explicit ThreadList(size_t insts = 0): dense(insts), sparse(insts), base(insts) {}
+
+        bool contains(uint32_t pc) const {
+            return sparse[pc] < size && dense[sparse[pc]] == pc;
+        }
+
+        void insert(uint32_t pc) {
+            sparse[pc] = size;
+            push(pc);
+        }
+
+        // counted threads are never looked up, one entering at this position is kept out by its Repeat pc
+        uint32_t insertCounted(uint32_t pc, uint32_t count) {
+            uint32_t id = base + counted.size();
+            counted.push_back({pc, count});
+            push(id);
+            return id;
+        }
+
+        uint32_t pcOf(uint32_t id) const {
+            return id < base ? id : counted[id - base].pc;
+        }
+
+        void clear() {
+            size = 0;
+            counted.clear();
+        }
+
+        // empty list for a program of insts instructions
+        void reset(size_t insts) {
+            if (sparse.size() < insts) {
+                dense.resize(insts);
+                sparse.resize(insts);
+            }
+            base = insts;
+            clear();
+        }
+
+    private:
+        void push(uint32_t id) {
+            if (size == dense.size()) dense.push_back(id);
+            else dense[size] = id;
+            size++;
+        }
+    };
+
+    // Thompson NFA simulation, every thread advances in lockstep so time is O(program * input)
+    // threads are kept in priority order which gives the same leftmost-first result as a backtracker
+    struct PikeVM {
+        struct Frame {
+            uint32_t pc;
+            // when slot is set the frame puts value back into that slot instead of visiting pc
+            long slot;
+            long value;
+        };
+
+        // buffers reused between runs, they only grow so a warm scratch never allocates
+        struct Scratch {
+            ThreadList clist;
+            ThreadList nlist;
+            std::vector<long> cslots;
+            std::vector<long> nslots;
+            std::vector<long> scratch;
+            std::vector<Frame> stack;
+
+            void prepare(size_t insts, size_t slotCount) {
+                // every instruction pushes at most one frame and every slot one restore
+                if (clist.sparse.size() < insts) stack.reserve(insts + 2 * slotCount);
+                clist.reset(insts);
+                nlist.reset(insts);
+                cslots.resize(insts * slotCount);
+                nslots.resize(insts * slotCount);
+                scratch.resize(slotCount);
+            }
+        };
+
+        const Program& prog;
+
+        explicit PikeVM(const Program& prog): prog(prog) {}
+
+        long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches) const {
+            std::vector<long> slots(prog.slotCount(), -1);
+
+            auto res = run(source, false, slots);
+            if (res < 0) return -1;
+
+            prog.collectCaptures(source, slots, matches);
+            return res;
+        }
+
+        bool doesMatch(std::string_view source) const {
+            std::vector<long> slots;
+            return run(source, true, slots) >= 0;
+        }
+
+        // returns length of the match anchored at the start of source or -1
+        // fullMatch only accepts matches ending at the end of source
+        // captured positions are written into slots, its size decides how many are tracked
+        long run(std::string_view source, bool fullMatch, std::vector<long>& slots) const {
+            Scratch s;
+            return exec(source, nullptr, fullMatch, slots, s);
+        }
+
+        // a budget makes the run stop with Budget::Exceeded once it is used up
+        long run(std::string_view source, bool fullMatch, std::vector<long>& slots, Scratch& s,
+                 Budget* budget = nullptr) const {
+            return exec(source, nullptr, fullMatch, slots, s, budget);
+        }
+
+        // leftmost-first match anywhere in source, returns its end or -1 and its start is stored in slots[0]
+        long search(std::string_view source, const Prefilter& prefilter, std::vector<long>& slots) const {
+            Scratch s;
+            return exec(source, &prefilter, false, slots, s);
+        }
+
+        long search(std::string_view source, const Prefilter& prefilter, std::vector<long>& slots, Scratch& s,
+                    Budget* budget = nullptr) const {
+            return exec(source, &prefilter, false, slots, s, budget);
+        }
+
+        // the closure and the step loop are shared with the other matchers driving threads in priority order, a
+        // thread there is a pc plus whatever the matcher keeps for it, which the Thread argument looks after:
+        //     save(slot, old) on a Save, true when it changed the slot and old has to be put back
+        //     restore(slot, old) once every branch after that Save was followed
+        //     store(id) when the thread lands on a consuming instruction or Match, or is counted on a Repeat
+
+        // follows Jmp, Split and Save from start and adds every reached consuming instruction
+        template<class Thread>
+        void addThread(ThreadList& list, std::vector<Frame>& stack, uint32_t start, Thread& thread) const {
+            stack.push_back({start, -1, 0});
+
+            while (!stack.empty()) {
+                auto frame = stack.back();
+                stack.pop_back();
+
+                if (frame.slot >= 0) {
+                    thread.restore(frame.slot, frame.value);
+                    continue;
+                }
+
+                auto pc = frame.pc;
+                while (!list.contains(pc)) {
+                    list.insert(pc);
+                    auto& inst = prog.insts[pc];
+
+                    if (inst.op == Op::Jmp) {
+                        pc = inst.x;
+                    }
+                    else if (inst.op == Op::Split) {
+                        stack.push_back({inst.x, -1, 0});
+                        pc++;
+                    }
+                    else if (inst.op == Op::Save) {
+                        long old;
+                        if (thread.save(inst.x, old)) stack.push_back({0, (long) inst.x, old});
+                        pc++;
+                    }
+                    else if (inst.op == Op::Repeat) {
+                        // leaving without a round is the lower priority alternative when the count allows it
+                        if (!count(list, pc, 0, thread)) break;
+                        pc++;
+                    }
+                    else {
+                        thread.store(pc);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // continues thread id of from after it consumed a byte, a counted thread counts it first
+        template<class Thread>
+        void addNext(ThreadList& list, std::vector<Frame>& stack, const ThreadList& from, uint32_t id,
+                     Thread& thread) const {
+            if (id < from.base) return addThread(list, stack, id + 1, thread);
+
+            auto [pc, done] = from.counted[id - from.base];
+            if (count(list, pc, done + 1, thread)) addThread(list, stack, pc + 1, thread);
+        }
+
+        // walks the threads of list in priority order, advance(id) for every one whose instruction takes c and
+        // matched(pc) for a Match, which returns whether to stop there, nullptr for c is past the end
+        template<class Matched, class Advance>
+        void step(const ThreadList& list, const unsigned char* c, Matched&& matched, Advance&& advance) const {
+            for (size_t i = 0; i < list.size; i++) {
+                auto id = list.dense[i];
+                auto pc = list.pcOf(id);
+                auto& inst = prog.insts[pc];
+
+                if (inst.op == Op::Match) {
+                    // threads after this one have lower priority
+                    if (matched(pc)) return;
+                    continue;
+                }
+                // the threads on a Repeat are the counted ones
+                if (inst.op == Op::Repeat && id == pc) continue;
+
+                if (c && prog.matches(inst, *c)) advance(id);
+            }
+        }
+
+        // NFA simulation without priorities or captures, every thread runs until it dies
+        // accepted(pos, pc) is called for every Match alive at pos and returns true to end the scan there
+        template<class Accepted>
+        void simulate(std::string_view source, Scratch& s, Accepted&& accepted) const {
+            s.prepare(prog.insts.size(), 0);
+            PlainThread thread;
+            addThread(s.clist, s.stack, 0, thread);
+
+            for (size_t pos = 0; s.clist.size > 0; pos++) {
+                bool stop = false;
+                auto c = pos < source.size() ? (const unsigned char*) source.data() + pos : nullptr;
+
+                s.nlist.clear();
+                step(s.clist, c, [&](uint32_t pc) {
+                    stop = accepted(pos, pc);
+                    return stop;
+                }, [&](uint32_t id) {
+                    addNext(s.nlist, s.stack, s.clist, id, thread);
+                });
+                if (stop || !c) return;
+
+                std::swap(s.clist, s.nlist);
+            }
+        }
+
+    private:
+        // a thread carrying nothing but its pc
+        struct PlainThread {
+            bool save(uint32_t slot, long& old) {
+                return false;
+            }
+
+            void restore(uint32_t slot, long old) {}
+
+            void store(uint32_t id) {}
+        };
+
+        // a thread carrying capture slots, scratch holds the ones of the thread being followed
+        struct SlotThread {
+            std::vector<long>& scratch;
+            std::vector<long>& listSlots;
+            long pos;
+
+            bool save(uint32_t slot, long& old) {
+                if (slot >= scratch.size()) return false;
+
+                old = scratch[slot];
+                scratch[slot] = pos;
+                return true;
+            }
+
+            void restore(uint32_t slot, long old) {
+                scratch[slot] = old;
+            }
+
+            void store(uint32_t id) {
+                auto at = id * scratch.size();
+                // counted threads go past the instructions the lists were sized for
+                if (at + scratch.size() > listSlots.size()) listSlots.resize(at + scratch.size());
+                std::copy(scratch.begin(), scratch.end(), listSlots.begin() + at);
+            }
+        };
+
+        // a Repeat thread at pc that consumed done bytes of it, counted when it may take another, true when
+        // it may leave
+        template<class Thread>
+        bool count(ThreadList& list, uint32_t pc, uint32_t done, Thread& thread) const {
+            auto& counter = prog.counters[prog.insts[pc].x];
+            if (done < counter.max) thread.store(list.insertCounted(pc, done));
+            return done >= counter.min;
+        }
+
+        // unanchored when prefilter is set, a new lowest priority thread then starts at every position until
+        // something matches and the prefilter skips ahead whenever no thread is alive
+        long exec(std::string_view source, const Prefilter* prefilter, bool fullMatch, std::vector<long>& slots,
+                  Scratch& s, Budget* budget = nullptr) const {
+            auto slotCount = slots.size();
+            s.prepare(prog.insts.size(), slotCount);
+
+            auto& clist = s.clist;
+            auto& nlist = s.nlist;
+            auto& cslots = s.cslots;
+            auto& nslots = s.nslots;
+            auto& scratch = s.scratch;
+            auto& stack = s.stack;
+
+            long matched = -1;
+            size_t pos = 0;
+
+            for (;; pos++) {
+                if (clist.size == 0) {
+                    if (matched >= 0 || (!prefilter && pos > 0)) break;
+                    if (prefilter && (pos = prefilter->next(source, pos)) == Prefilter::npos) break;
+
+                    std::fill(scratch.begin(), scratch.end(), -1);
+                    addThread(clist, cslots, stack, scratch, 0, pos);
+                }
+
+                // every live thread is a step
+                if (budget && budget->charge(clist.size)) return Budget::Exceeded;
+
+                nlist.clear();
+
+                auto c = pos < source.size() ? (const unsigned char*) source.data() + pos : nullptr;
+                step(clist, c, [&](uint32_t pc) {
+                    if (fullMatch && pos != source.size()) return false;
+
+                    auto threadSlots = cslots.data() + pc * slotCount;
+                    std::copy(threadSlots, threadSlots + slotCount, slots.begin());
+                    matched = pos;
+                    return true;
+                }, [&](uint32_t id) {
+                    auto threadSlots = cslots.data() + id * slotCount;
+                    std::copy(threadSlots, threadSlots + slotCount, scratch.begin());
+                    SlotThread thread{scratch, nslots, long(pos + 1)};
+                    addNext(nlist, stack, clist, id, thread);
+                });
+
+                if (pos >= source.size()) break;
+
+                if (prefilter && matched < 0) {
+                    std::fill(scratch.begin(), scratch.end(), -1);
+                    addThread(nlist, nslots, stack, scratch, 0, pos + 1);
+                }
+
+                std::swap(clist, nlist);
+                std::swap(cslots, nslots);
+            }
+
+            return matched;
+        }
+
+        // starts a thread at start with the slots in scratch, the ones it saves on the way end up in listSlots
+        void addThread(ThreadList& list, std::vector<long>& listSlots, std::vector<Frame>& stack,
+                       std::vector<long>& scratch, uint32_t start, long pos) const {
+            SlotThread thread{scratch, listSlots, pos};
+            addThread(list, stack, start, thread);
+        }
+    };
+}
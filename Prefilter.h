@@ -0,0 +1,218 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+
+#include "Program.h"
+#include "LiteralSet.h"
+
+namespace regix {
+    // cheap scan for positions where a match can start, so engines skip the rest of the input
+    // in order of preference a single literal prefix, a set of literal prefixes found with Teddy or Aho-Corasick
+    // and a set of first bytes
+    struct Prefilter {
+        static constexpr size_t npos = std::string_view::npos;
+        // literal sets above this size are not worth an automaton
+        static constexpr size_t maxLiterals = 256;
+        // literals are cut to this length, the engine checks the rest
+        static constexpr size_t maxLiteralLength = 16;
+
+        // every match starts with these bytes
+        std::string prefix;
+        // every match starts with one of these, when there is more than one
+        std::vector<std::string> literals;
+        std::optional<Teddy> teddy;
+        std::optional<AhoCorasick> automaton;
+        // bytes a match can start with
+        CharSet first;
+        // the program can match without consuming anything, so every position is a candidate
+        bool emptyMatch = false;
+        // skips bytes outside of first
+        Span skip;
+
+        static Prefilter fromProgram(const Program& prog) {
+            Prefilter res;
+
+            if (auto lits = literalPrefixes(prog)) {
+                if (lits->size() == 1) {
+                    res.prefix = std::move((*lits)[0]);
+                }
+                // a set with a single byte literal is no better than the first byte scan
+                else if (std::all_of(lits->begin(), lits->end(), [](auto& lit) { return lit.size() > 1; })) {
+                    res.literals = std::move(*lits);
+                }
+            }
+
+            // first bytes come from every consuming instruction reachable from the start
+            std::vector<uint32_t> stack{0};
+            std::vector<bool> seen(prog.insts.size());
+            while (!stack.empty()) {
+                auto at = stack.back();
+                stack.pop_back();
+                if (seen[at]) continue;
+                seen[at] = true;
+
+                auto& inst = prog.insts[at];
+                switch (inst.op) {
+                    case Op::Char:
+                        res.first.set(inst.c);
+                        break;
+                    case Op::Any:
+                        res.first = ~CharSet{};
+                        break;
+                    case Op::Class:
+                        res.first |= prog.classes[inst.x];
+                        break;
+                    case Op::Split:
+                        stack.push_back(inst.x);
+                        stack.push_back(at + 1);
+                        break;
+                    case Op::Jmp:
+                        stack.push_back(inst.x);
+                        break;
+                    case Op::Save:
+                        stack.push_back(at + 1);
+                        break;
+                    case Op::Match:
+                        res.emptyMatch = true;
+                        break;
+                    case Op::Repeat:
+                        res.first |= prog.classes[prog.counters[inst.x].cls];
+                        if (prog.counters[inst.x].min == 0) stack.push_back(at + 1);
+                        break;
+                }
+            }
+
+            res.prepare();
+            return res;
+        }
+
+        // builds the finders from literals and first, which is all a saved prefilter has to restore
+        void prepare() {
+            teddy.reset();
+            automaton.reset();
+            if (!literals.empty()) {
+                if (literals.size() <= Teddy::maxLiterals) teddy.emplace(literals);
+                else automaton.emplace(literals);
+            }
+            skip = Span(~first);
+        }
+
+        // position of the next candidate at or after from, npos when there is none
+        size_t next(std::string_view source, size_t from) const {
+            if (from > source.size()) return npos;
+            if (emptyMatch) return from;
+
+            auto data = source.data();
+            auto left = source.size() - from;
+
+            if (prefix.size() == 1) {
+                auto found = (const char*) memchr(data + from, prefix[0], left);
+                return found ? found - data : npos;
+            }
+            if (prefix.size() > 1) {
+                auto found = (const char*) memmem(data + from, left, prefix.data(), prefix.size());
+                return found ? found - data : npos;
+            }
+            if (teddy) return teddy->find(source, from);
+            if (automaton) return automaton->find(source, from);
+
+            auto i = from + skip(data + from, left);
+            return i < source.size() ? i : npos;
+        }
+
+        size_t memoryUsage() const {
+            size_t res = sizeof(Prefilter) + prefix.size() + (automaton ? automaton->memoryUsage() : 0);
+            for (auto& lit : literals) {
+                res += lit.size() + sizeof(std::string);
+            }
+            return res;
+        }
+
+        // literals one of which starts every match, found by following every path from the start and collecting
+        // the bytes it consumes until something that is not a literal, alternations and small classes fork the
+        // path, nullopt when some path starts without a literal or there are too many
+        static std::optional<std::vector<std::string>> literalPrefixes(const Program& prog) {
+            struct Path {
+                uint32_t pc;
+                std::string literal;
+                // instructions passed since the last byte, an empty loop would otherwise never end
+                std::vector<uint32_t> since;
+            };
+
+            std::vector<std::string> res;
+            std::vector<Path> stack{{0, "", {}}};
+            size_t steps = 0;
+
+            auto done = [&](Path& path) {
+                if (path.literal.empty()) return false;
+                res.push_back(std::move(path.literal));
+                return res.size() <= 4 * maxLiterals;
+            };
+
+            while (!stack.empty()) {
+                if (++steps > 64 * maxLiterals) return std::nullopt;
+
+                auto path = std::move(stack.back());
+                stack.pop_back();
+
+                if (std::find(path.since.begin(), path.since.end(), path.pc) != path.since.end()) continue;
+                path.since.push_back(path.pc);
+
+                auto& inst = prog.insts[path.pc];
+                if (inst.op == Op::Save) {
+                    path.pc++;
+                    stack.push_back(std::move(path));
+                }
+                else if (inst.op == Op::Jmp) {
+                    path.pc = inst.x;
+                    stack.push_back(std::move(path));
+                }
+                else if (inst.op == Op::Split) {
+                    stack.push_back({inst.x, path.literal, path.since});
+                    path.pc++;
+                    stack.push_back(std::move(path));
+                }
+                else if (inst.op == Op::Char && path.literal.size() < maxLiteralLength) {
+                    path.literal += inst.c;
+                    path.pc++;
+                    path.since.clear();
+                    stack.push_back(std::move(path));
+                }
+                else if (inst.op == Op::Class && path.literal.size() < maxLiteralLength &&
+                         countOf(prog.classes[inst.x]) <= 8) {
+                    for (unsigned c = 0; c < 256; c++) {
+                        if (!prog.classes[inst.x].contains(c)) continue;
+                        stack.push_back({path.pc + 1, path.literal + (char) c, {}});
+                    }
+                }
+                else if (!done(path)) {
+                    return std::nullopt;
+                }
+            }
+
+            // a literal that starts with another one adds no candidates
+            std::sort(res.begin(), res.end());
+            std::vector<std::string> kept;
+            for (auto& lit : res) {
+                if (kept.empty() || !lit.starts_with(kept.back())) kept.push_back(std::move(lit));
+            }
+            if (kept.size() > maxLiterals) return std::nullopt;
+
+            return kept;
+        }
+
+    private:
+        static size_t countOf(const CharSet& set) {
+            size_t res = 0;
+            for (auto word : set.bits) {
+                res += __builtin_popcountll(word);
+            }
+            return res;
+        }
+    };
+}
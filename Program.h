@@ -0,0 +1,225 @@
+#pragma once
+
+#include <iostream>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+#include "CharSet.h"
+#include "Span.h"
+
+namespace regix {
+    enum class Op: uint8_t {
+        Char,   // consume byte c
+        Any,    // consume any byte
+        Class,  // consume byte contained in classes[x]
+        Split,  // fork to pc+1 (preferred) and x, c is set when pc+1 is the body of a single byte loop
+        Jmp,    // continue at x
+        Save,   // store current position into capture slot x
+        Match,  // accept, x identifies the pattern when several are combined
+        Repeat, // consume a run of counters[x].min to counters[x].max bytes of its class, longer runs preferred
+    };
+
+    // fixed size instruction with its operand inline, classes are referenced by index
+    struct Inst {
+        Op op;
+        char c = 0;
+        uint32_t x = 0;
+    };
+
+    static_assert(sizeof(Inst) == 8);
+
+    // bounds of a Repeat, a count too large to unroll into one instruction per round
+    struct Counter {
+        uint32_t cls;
+        uint32_t min;
+        uint32_t max;
+    };
+
+    // flat instruction list produced by lowering the node tree
+    // slot 0 and 1 hold bounds of the whole match, capture group n uses slots 2n+2 and 2n+3
+    struct Program {
+        std::vector<Inst> insts;
+        std::vector<CharSet> classes;
+        // span tables of classes, same indices
+        std::vector<Span> spans;
+        std::vector<Counter> counters;
+        size_t captureCount = 0;
+
+        size_t slotCount() const {
+            return 2 * (captureCount + 1);
+        }
+
+        size_t memoryUsage() const {
+            return sizeof(Program) + insts.size() * sizeof(Inst) + classes.size() * (sizeof(CharSet) + sizeof(Span)) +
+                   counters.size() * sizeof(Counter);
+        }
+
+        // converts positions stored in slots into views appended to matches[group]
+        void collectCaptures(std::string_view source, const std::vector<long>& slots,
+                             std::vector<std::vector<std::string_view>>& matches) const {
+            matches.resize(captureCount);
+            for (size_t i = 0; i < captureCount; i++) {
+                auto start = slots[2 * i + 2];
+                auto end = slots[2 * i + 3];
+                if (start >= 0 && end >= start) {
+                    matches[i].push_back(source.substr(start, end - start));
+                }
+            }
+        }
+
+        void collectCaptures(std::string_view source, const std::vector<long>& slots,
+                             std::vector<std::string_view>& groups) const {
+            for (size_t i = 0; i < captureCount; i++) {
+                auto start = slots[2 * i + 2];
+                auto end = slots[2 * i + 3];
+                groups[i] = start >= 0 && end >= start ? source.substr(start, end - start) : std::string_view();
+            }
+        }
+
+        // whether inst takes c, a Repeat only answers for the byte of one round
+        bool matches(const Inst& inst, unsigned char c) const {
+            switch (inst.op) {
+                case Op::Char:
+                    return inst.c == (char) c;
+                case Op::Any:
+                    return true;
+                case Op::Class:
+                    return classes[inst.x].contains(c);
+                case Op::Repeat:
+                    return classes[counters[inst.x].cls].contains(c);
+                default:
+                    return false;
+            }
+        }
+
+        void print() const {
+            for (size_t pc = 0; pc < insts.size(); pc++) {
+                auto& inst = insts[pc];
+                std::cout << pc << ": ";
+                switch (inst.op) {
+                    case Op::Char:
+                        std::cout << "CHAR(" << inst.c << ')';
+                        break;
+                    case Op::Any:
+                        std::cout << "ANY";
+                        break;
+                    case Op::Class:
+                        std::cout << "CLASS " << inst.x;
+                        break;
+                    case Op::Split:
+                        std::cout << "SPLIT " << pc + 1 << ", " << inst.x;
+                        break;
+                    case Op::Jmp:
+                        std::cout << "JMP " << inst.x;
+                        break;
+                    case Op::Save:
+                        std::cout << "SAVE " << inst.x;
+                        break;
+                    case Op::Match:
+                        std::cout << "MATCH " << inst.x;
+                        break;
+                    case Op::Repeat: {
+                        auto& counter = counters[inst.x];
+                        std::cout << "REPEAT " << counter.cls << " {" << counter.min << ',' << counter.max << '}';
+                        break;
+                    }
+                }
+                std::cout << std::endl;
+            }
+        }
+    };
+
+    struct ProgramBuilder {
+        // counts of one byte up to this many rounds are unrolled, larger ones become a Repeat
+        static constexpr size_t defaultMaxUnrolled = 64;
+
+        Program prog;
+        size_t maxUnrolled = defaultMaxUnrolled;
+
+        uint32_t pc() const {
+            return prog.insts.size();
+        }
+
+        uint32_t emit(Inst inst) {
+            prog.insts.push_back(inst);
+            return pc() - 1;
+        }
+
+        Inst& at(uint32_t pc) {
+            return prog.insts[pc];
+        }
+
+        uint32_t addClass(const CharSet& set) {
+            for (size_t i = 0; i < prog.classes.size(); i++) {
+                if (prog.classes[i] == set) return i;
+            }
+            prog.classes.push_back(set);
+            prog.spans.emplace_back(set);
+            return prog.classes.size() - 1;
+        }
+
+        uint32_t addCounter(const CharSet& set, uint32_t min, uint32_t max) {
+            prog.counters.push_back({addClass(set), min, max});
+            return prog.counters.size() - 1;
+        }
+
+        // marks greedy loops over one byte so engines can consume the whole run with a single Span scan,
+        // Char bodies become classes to get a span table
+        void markSpans() {
+            for (uint32_t pc = 0; pc + 2 < prog.insts.size(); pc++) {
+                auto& split = prog.insts[pc];
+                auto& body = prog.insts[pc + 1];
+                auto& jmp = prog.insts[pc + 2];
+                if (split.op != Op::Split || split.x != pc + 3 || jmp.op != Op::Jmp || jmp.x != pc) continue;
+
+                if (body.op == Op::Char) {
+                    CharSet set;
+                    set.set(body.c);
+                    body = {Op::Class, 0, addClass(set)};
+                }
+                if (body.op == Op::Class || body.op == Op::Any) split.c = 1;
+            }
+        }
+
+        void useCapture(long id) {
+            if ((size_t) id + 1 > prog.captureCount) prog.captureCount = id + 1;
+        }
+
+        // copies other behind the current instructions with jump targets and classes relocated
+        // its Match instructions get matchId, returns pc of its first instruction
+        uint32_t append(const Program& other, uint32_t matchId) {
+            auto base = pc();
+            for (auto inst : other.insts) {
+                if (inst.op == Op::Split || inst.op == Op::Jmp) {
+                    inst.x += base;
+                }
+                else if (inst.op == Op::Class) {
+                    inst.x = addClass(other.classes[inst.x]);
+                }
+                else if (inst.op == Op::Match) {
+                    inst.x = matchId;
+                }
+                else if (inst.op == Op::Repeat) {
+                    auto& counter = other.counters[inst.x];
+                    inst.x = addCounter(other.classes[counter.cls], counter.min, counter.max);
+                }
+                emit(inst);
+            }
+            if (other.captureCount > prog.captureCount) prog.captureCount = other.captureCount;
+            return base;
+        }
+    };
+
+    // prog matching anywhere in the input, a loop eating one byte is run in front of it
+    Program unanchored(const Program& prog) {
+        ProgramBuilder builder;
+        builder.emit({Op::Split, 0, 2});
+        builder.emit({Op::Jmp, 0, 4});
+        builder.emit({Op::Any});
+        builder.emit({Op::Jmp, 0, 0});
+        builder.append(prog, 0);
+        return builder.prog;
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+
+#include "Regix.h"
+#include "LazyDFA.h"
+
+namespace regix {
+    // many patterns merged into one program, a single DFA scan reports every pattern that matched
+    // so the cost per input grows with its length and not with the number of patterns
+    // patterns are found anywhere in the input, an anchored set requires them to match the whole input
+    struct RegexSet {
+        // per thread state for matches, reuse it between inputs
+        struct Cache {
+            LazyDFA dfa;
+            std::vector<bool> matched;
+        };
+
+        explicit RegexSet(bool anchored = false): anchored(anchored) {
+            if (!anchored) {
+                // any byte may precede a match, 0 forks into the patterns or into the loop eating one byte
+                builder.emit({Op::Split, 0, 2});
+            }
+            entry = builder.emit({Op::Jmp});
+            if (!anchored) {
+                builder.emit({Op::Any});
+                builder.emit({Op::Jmp, 0, 0});
+            }
+            // empty class never matches, it ends the chain of patterns
+            fail = builder.emit({Op::Class, 0, builder.addClass({})});
+            builder.at(entry).x = fail;
+        }
+
+        // returns id of the added pattern, -1 when it is malformed or cant be compiled
+        long add(std::string_view pattern) {
+            auto tree = constructRegix(pattern);
+            if (!tree) return -1;
+
+            auto prog = compileProgram(*tree);
+            if (!prog) return -1;
+
+            // every pattern is entered through a split whose alternative leads to the next pattern
+            auto split = builder.emit({Op::Split, 0, fail});
+            builder.at(count == 0 ? entry : tail).x = split;
+            builder.append(*prog, count);
+            tail = split;
+
+            return count++;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        const Program& program() const {
+            return builder.prog;
+        }
+
+        // caches are tied to the patterns added so far, create them once the set is complete
+        Cache cache(size_t memoryLimit = 8 << 20) const {
+            return {LazyDFA(builder.prog, memoryLimit), std::vector<bool>(count)};
+        }
+
+        // ids of every pattern matching input in ascending order
+        std::vector<size_t> matches(std::string_view input) const {
+            auto c = cache();
+            std::vector<size_t> res;
+            matches(input, c, res);
+            return res;
+        }
+
+        void matches(std::string_view input, Cache& c, std::vector<size_t>& res) const {
+            res.clear();
+            c.matched.assign(count, false);
+            c.dfa.collect(input, anchored, c.matched);
+
+            for (size_t i = 0; i < count; i++) {
+                if (c.matched[i]) res.push_back(i);
+            }
+        }
+
+    private:
+        bool anchored;
+        ProgramBuilder builder;
+        size_t count = 0;
+        uint32_t entry = 0;
+        uint32_t fail = 0;
+        uint32_t tail = 0;
+    };
+}
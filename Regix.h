@@ -8,16 +8,22 @@
 #include <valarray>
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <set>
 #include <chrono>
+#include <cstring>
+#include <climits>
+
+#include "Program.h"
+#include "Budget.h"
 
 #define PRINT_REPEAT(thing, x) ({for (auto i = 0; i < x; i++) { std::cout << thing; }})
 
 namespace utils {
     template<typename Iterator>
     constexpr std::string_view slice(Iterator& str, long index = 0, long amount = -1)  {
-        assert(index >= 0);
-        assert(index + amount <= str.size());
+        assert(index >= 0 && (size_t) index <= str.size());
+        assert(amount < 0 || (size_t) (index + amount) <= str.size());
         return {str.begin()+index, str.begin()+index+(amount >= 0 ? amount : str.size()-index)};
     }
 
@@ -42,15 +48,15 @@ namespace lexer {
         std::string_view data;
         uint index = 0;
 
-        explicit Lexer(std::string_view data): data(data) {}
+        constexpr explicit Lexer(std::string_view data): data(data) {}
 
-        bool isPeek(char c) const {
-            if (index+1 >= data.size()) return false;
+        constexpr bool isPeek(char c) const {
+            if (index >= data.size()) return false;
 
             return data[index] == c;
         }
 
-        void consume(uint amount = 1) {
+        constexpr void consume(uint amount = 1) {
             index += amount;
         }
 
@@ -61,7 +67,7 @@ namespace lexer {
             return f(st);
         }
 
-        bool isDone() const {
+        constexpr bool isDone() const {
             return index >= data.size();
         }
     };
@@ -76,22 +82,100 @@ std::chrono::duration<long, std::ratio<1, 1000000>> measureTime(Func f) {
 }
 
 namespace regix {
-    const std::set<char> invalidChars{'(', '[', '|', '?', '*', '+', '.', '^', ']', ')'};
+    const std::set<char> invalidChars{'(', '[', '|', '?', '*', '+', '.', '^', ']', ')', '{'};
+
+    struct Regix;
+
+    // dropping a node runs its destructor and leaves the memory to the arena it came from
+    struct NodeDelete {
+        void operator()(Regix* node) const;
+    };
+
+    using Node = std::unique_ptr<Regix, NodeDelete>;
+    using NodeList = std::pmr::vector<Node>;
+
+    // memory of one tree, nodes and child lists are carved out of a few contiguous blocks that are freed together
+    // when the tree goes away, instead of one heap allocation per node
+    struct Arena {
+        std::pmr::monotonic_buffer_resource resource;
+
+        explicit Arena(size_t initialSize): resource(initialSize) {}
+
+        template<class T, class... Args>
+        Node make(Args&&... args) {
+            return Node(new (resource.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...));
+        }
+
+        NodeList list() {
+            return NodeList(&resource);
+        }
+    };
+
+    // closed set of node kinds, the passes over the tree switch on it instead of trying one dynamic_cast after
+    // the other
+    enum class Kind: uint8_t {
+        Any,
+        Char,
+        Literal,
+        CharClass,
+        XAndMore,
+        Repeat,
+        Optional,
+        Capture,
+        Group,
+        Or,
+        Not,
+    };
 
     struct Regix {
-        virtual long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches) = 0;
+        const Kind kind;
+
+        explicit Regix(Kind kind): kind(kind) {}
+        virtual ~Regix() = default;
+
+        // length of the match at the start of source or -1
+        // a budget is charged a step for every node entered, once it runs out every node fails right away and
+        // the result means nothing, Tree::match tells that case apart
+        long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   Budget* budget = nullptr) {
+            if (budget && (budget->exceeded() || budget->charge(1))) return -1;
+            return run(source, matches, budget);
+        }
+        virtual long run(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                         Budget* budget) = 0;
         virtual void print(int offset = 0) = 0;
+        // lowers the node into flat instructions, returns false when it cant be expressed
+        virtual bool emit(ProgramBuilder& b) = 0;
+
+        // set of bytes matched when the node always consumes exactly one byte
+        virtual bool byteSet(CharSet& out) {
+            return false;
+        }
+
+        // longest match at the start of source shorter than below, a length this node matched on source before,
+        // or -1 when there is none, only a bounded repeat gives rounds back like this
+        virtual long retry(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                           Budget* budget, long below) {
+            return -1;
+        }
 
         bool doesMatch(std::string_view source) {
             std::vector<std::vector<std::string_view>> ms;
 
             auto res = match(source, ms);
-            return res == source.size();
+            return res == (long) source.size();
         }
     };
 
+    inline void NodeDelete::operator()(Regix* node) const {
+        node->~Regix();
+    }
+
     struct Any: public Regix {
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
+        Any(): Regix(Kind::Any) {}
+
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
             if (!source.empty())
                 return 1;
             else
@@ -102,14 +186,25 @@ namespace regix {
             PRINT_REPEAT(' ', offset*2);
             std::cout << "ANY" << std::endl;
         }
+
+        bool emit(ProgramBuilder& b) override {
+            b.emit({Op::Any});
+            return true;
+        }
+
+        bool byteSet(CharSet& out) override {
+            out = ~CharSet{};
+            return true;
+        }
     };
 
     struct Char: public Regix {
         char c;
 
-        explicit Char(char c): c(c) {}
+        explicit Char(char c): Regix(Kind::Char), c(c) {}
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
             return utils::isPeekChar(source, c) ? 1 : -1;
         }
 
@@ -117,60 +212,155 @@ namespace regix {
             PRINT_REPEAT(' ', offset*2);
             std::cout << "CHAR(" << c << ')' << std::endl;
         }
-    };
 
-    struct Numeric: public Regix {
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            return utils::isPeek(source, [](auto c){
-                return isdigit(c);
-            }) ? 1 : -1;
+        bool emit(ProgramBuilder& b) override {
+            b.emit({Op::Char, c});
+            return true;
         }
 
-        void print(int offset = 0) override {
-            PRINT_REPEAT(' ', offset*2);
-            std::cout << "DIGIT" << std::endl;
+        bool byteSet(CharSet& out) override {
+            out = {};
+            out.set(c);
+            return true;
         }
     };
 
-    struct Whitespace: public Regix {
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            return utils::isPeek(source, [](auto c){
-                return isspace(c);
-            }) ? 1 : -1;
+    // run of chars merged by optimize, compared in one go
+    struct Literal: public Regix {
+        std::string str;
+
+        explicit Literal(std::string str): Regix(Kind::Literal), str(std::move(str)) {}
+
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            if (source.size() < str.size() || memcmp(source.data(), str.data(), str.size()) != 0) return -1;
+            return str.size();
         }
 
         void print(int offset = 0) override {
             PRINT_REPEAT(' ', offset*2);
-            std::cout << "WHITESPACE" << std::endl;
+            std::cout << "LITERAL(" << str << ')' << std::endl;
+        }
+
+        bool emit(ProgramBuilder& b) override {
+            for (auto c : str) {
+                b.emit({Op::Char, c});
+            }
+            return true;
         }
     };
 
-    struct Letter: public Regix {
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            return utils::isPeek(source, [](auto c){
-                return isalpha(c);
+    // single byte out of a 256 bit set, tested with one lookup
+    struct CharClass: public Regix {
+        CharSet set;
+
+        explicit CharClass(const CharSet& set): Regix(Kind::CharClass), set(set) {}
+
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            return utils::isPeek(source, [this](auto c){
+                return set.contains(c);
             }) ? 1 : -1;
         }
 
         void print(int offset = 0) override {
             PRINT_REPEAT(' ', offset*2);
-            std::cout << "LETTER" << std::endl;
+            std::cout << "CLASS[";
+            for (unsigned c = 0; c < 256; c++) {
+                if (!set.contains(c)) continue;
+
+                auto end = c;
+                while (end < 255 && set.contains(end + 1)) end++;
+
+                printClassChar(c);
+                if (end > c) {
+                    std::cout << '-';
+                    printClassChar(end);
+                }
+                c = end;
+            }
+            std::cout << ']' << std::endl;
+        }
+
+        bool emit(ProgramBuilder& b) override {
+            b.emit({Op::Class, 0, b.addClass(set)});
+            return true;
+        }
+
+        bool byteSet(CharSet& out) override {
+            out = set;
+            return true;
+        }
+
+    private:
+        static void printClassChar(unsigned char c) {
+            if (isprint(c)) {
+                std::cout << c;
+            }
+            else {
+                std::cout << "\\x" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+            }
         }
     };
 
+    // counts of {n,m} above this make the pattern malformed
+    constexpr size_t maxRepeatCount = 100000;
+    // a count of one byte past ProgramBuilder::maxUnrolled rounds is lowered to a Repeat instruction, any other
+    // count becomes one copy of its inner node per round and may take this many instructions, past that the
+    // pattern has no flat form and only the tree runs it
+    constexpr size_t maxRepeatEmitted = 1 << 12;
+
+    // emits one more round of a repeat that started at start, false when inner has no flat form or the rounds went
+    // over maxRepeatEmitted
+    inline bool emitRound(ProgramBuilder& b, Regix& inner, uint32_t start) {
+        return inner.emit(b) && b.pc() - start <= maxRepeatEmitted;
+    }
+
+    inline bool emitCounted(ProgramBuilder& b, Regix& inner, size_t min, size_t max);
+
+    // number of captures recorded for every group, so the ones of an attempt that failed can be dropped again
+    inline std::vector<size_t> captureMarks(const std::vector<std::vector<std::string_view>>& matches) {
+        std::vector<size_t> marks;
+        for (auto& group : matches) {
+            marks.push_back(group.size());
+        }
+        return marks;
+    }
+
+    inline void dropCaptures(std::vector<std::vector<std::string_view>>& matches, const std::vector<size_t>& marks) {
+        matches.resize(marks.size());
+        for (size_t i = 0; i < marks.size(); i++) {
+            matches[i].resize(marks[i]);
+        }
+    }
+
     struct XAndMore: public Regix {
-        std::unique_ptr<Regix> inner;
+        Node inner;
         size_t amount;
+        // inner always consumes one byte, the whole run is then found by one Span scan
+        bool single;
+        Span span;
+
+        explicit XAndMore(Node inner, size_t amount): Regix(Kind::XAndMore), inner(std::move(inner)), amount(amount) {
+            CharSet set;
+            single = this->inner->byteSet(set);
+            if (single) span = Span(set);
+        }
 
-        explicit XAndMore(std::unique_ptr<Regix> inner, size_t amount): inner(std::move(inner)), amount(amount) {}
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            if (single) {
+                size_t run = span(source.data(), source.size());
+                if (budget) budget->charge(run);
+                return run >= amount ? run : -1;
+            }
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            long matchCount;
-            long matchAmount;
+            size_t matchCount = 0;
+            long matchAmount = 0;
             std::string_view src = source;
 
             while (true) {
-                auto res = inner->match(src, matches);
+                auto res = inner->match(src, matches, budget);
                 if (res < 0) {
                     if (matchCount >= amount)
                         return matchAmount;
@@ -179,6 +369,8 @@ namespace regix {
                 }
                 matchCount++;
                 matchAmount += res;
+                // another round would match empty again, forever
+                if (res == 0) return matchAmount;
                 src = utils::slice(src, res);
             }
         }
@@ -188,15 +380,122 @@ namespace regix {
             std::cout << amount << "..MORE" << std::endl;
             inner->print(++offset);
         }
+
+        bool emit(ProgramBuilder& b) override {
+            if (emitCounted(b, *inner, amount, SIZE_MAX)) return true;
+
+            auto start = b.pc();
+            for (size_t i = 0; i < amount; i++) {
+                if (!emitRound(b, *inner, start)) return false;
+            }
+            auto split = b.emit({Op::Split});
+            if (!emitRound(b, *inner, start)) return false;
+            b.emit({Op::Jmp, 0, split});
+            b.at(split).x = b.pc();
+            return true;
+        }
+    };
+
+    // inner between min and max times for {n} and {n,m}, greedy, the sequence it is in takes rounds back through
+    // retry when the nodes after it fail, unlike XAndMore which never gives anything back
+    // the tree keeps a count of the rounds, a single byte inner is one Span scan cut off at max
+    struct Repeat: public Regix {
+        Node inner;
+        size_t min;
+        size_t max;
+        bool single;
+        Span span;
+
+        Repeat(Node inner, size_t min, size_t max): Regix(Kind::Repeat), inner(std::move(inner)), min(min), max(max) {
+            CharSet set;
+            single = this->inner->byteSet(set);
+            if (single) span = Span(set);
+        }
+
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            if (single) {
+                size_t run = span(source.data(), std::min(source.size(), max));
+                if (budget) budget->charge(run);
+                return run >= min ? run : -1;
+            }
+            size_t count;
+            return rounds(source, matches, budget, LONG_MAX, max, count);
+        }
+
+        // one round less than the match of length below, the bytes of a single byte inner are known to match
+        long retry(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   Budget* budget, long below) override {
+            if (below <= 0) return -1;
+            if (single) return size_t(below - 1) >= min ? below - 1 : -1;
+
+            // the round that reaches below is only found by matching it, its captures are dropped by running the
+            // rounds before it again
+            auto marks = captureMarks(matches);
+            size_t count;
+            auto res = rounds(source, matches, budget, below, max, count);
+            if (res < 0 || marks == captureMarks(matches)) return res;
+
+            dropCaptures(matches, marks);
+            return rounds(source, matches, budget, below, count, count);
+        }
+
+        void print(int offset = 0) override {
+            PRINT_REPEAT(' ', offset*2);
+            std::cout << min << ".." << max << std::endl;
+            inner->print(++offset);
+        }
+
+        // min copies of inner followed by max - min optional ones, each of which may end the repeat
+        bool emit(ProgramBuilder& b) override {
+            if (emitCounted(b, *inner, min, max)) return true;
+
+            auto start = b.pc();
+            for (size_t i = 0; i < min; i++) {
+                if (!emitRound(b, *inner, start)) return false;
+            }
+
+            std::vector<uint32_t> splits;
+            for (size_t i = min; i < max; i++) {
+                splits.push_back(b.emit({Op::Split}));
+                if (!emitRound(b, *inner, start)) return false;
+            }
+            for (auto split : splits) {
+                b.at(split).x = b.pc();
+            }
+            return true;
+        }
+
+    private:
+        // greedy rounds of inner, at most limit of them and together shorter than below, count gets their number
+        long rounds(std::string_view source, std::vector<std::vector<std::string_view>>& matches, Budget* budget,
+                    long below, size_t limit, size_t& count) {
+            count = 0;
+            long total = 0;
+            auto src = source;
+
+            while (count < limit) {
+                auto res = inner->match(src, matches, budget);
+                if (res < 0 || total + res >= below) break;
+
+                count++;
+                total += res;
+                // the rounds still missing would all match empty as well
+                if (res == 0) return total;
+                src = utils::slice(src, res);
+            }
+            return count >= min ? total : -1;
+        }
     };
 
     struct Optional: public Regix {
-        std::unique_ptr<Regix> inner;
+        Node inner;
 
-        Optional(std::unique_ptr<Regix> inner): inner(std::move(inner)) {}
+        Optional(Node inner): Regix(Kind::Optional), inner(std::move(inner)) {}
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            auto res =  inner->match(source, matches);
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            auto res =  inner->match(source, matches, budget);
             if (res < 0) {
                 return 0;
             }
@@ -208,30 +507,40 @@ namespace regix {
             std::cout << "OPTIONAL" << std::endl;
             inner->print(++offset);
         }
+
+        bool emit(ProgramBuilder& b) override {
+            auto split = b.emit({Op::Split});
+            if (!inner->emit(b)) return false;
+            b.at(split).x = b.pc();
+            return true;
+        }
     };
 
+    inline long matchSequence(NodeList& nodes, size_t from, std::string_view source,
+                              std::vector<std::vector<std::string_view>>& matches, Budget* budget);
+
     struct Capture: public Regix {
-        std::vector<std::unique_ptr<Regix>> inner;
+        NodeList inner;
         long id;
 
-        explicit Capture(std::vector<std::unique_ptr<Regix>> inner, long id) : inner(std::move(inner)), id(id) {}
-
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            long matchAmount;
-            auto src = source;
+        explicit Capture(NodeList inner, long id): Regix(Kind::Capture), inner(std::move(inner)), id(id) {}
 
-            for (auto& matcher : inner) {
-                auto res = matcher->match(src, matches);
-                if (res < 0) {
-                    return -1;
-                }
-                matchAmount += res;
-                src = utils::slice(src, res);
-            }
-            matches[id].push_back(utils::slice(source, 0, matchAmount));
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            auto matchAmount = matchSequence(inner, 0, source, matches, budget);
+            if (matchAmount < 0) return -1;
+            record(source, matches, matchAmount);
             return matchAmount;
         }
 
+        long retry(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   Budget* budget, long below) override {
+            if (inner.size() != 1) return -1;
+            auto res = inner[0]->retry(source, matches, budget, below);
+            if (res >= 0) record(source, matches, res);
+            return res;
+        }
+
         void print(int offset = 0) override {
             PRINT_REPEAT(' ', offset*2);
             std::cout << "CAPTURE" << std::endl;
@@ -239,27 +548,78 @@ namespace regix {
                 in->print(offset+1);
             }
         }
+
+        bool emit(ProgramBuilder& b) override {
+            b.useCapture(id);
+            b.emit({Op::Save, 0, uint32_t(2 * id + 2)});
+            for (auto& in : inner) {
+                if (!in->emit(b)) return false;
+            }
+            b.emit({Op::Save, 0, uint32_t(2 * id + 3)});
+            return true;
+        }
+
+    private:
+        void record(std::string_view source, std::vector<std::vector<std::string_view>>& matches, long length) {
+            if (matches.size() <= (size_t) id) matches.resize(id + 1);
+            matches[id].push_back(utils::slice(source, 0, length));
+        }
     };
 
-    struct Group: public Regix {
-        std::vector<std::unique_ptr<Regix>> inner;
+    // inner{min,max} as a Repeat when inner takes one byte, on its own or captured, and the count is too large to
+    // unroll, false when the repeat is not one of those, max is SIZE_MAX for an open count
+    // an open count ends in a loop like x* so a Repeat is always bounded, and since a capture only keeps its last
+    // round (x){n,m} is lowered as x{n-1,m-1}(x)
+    inline bool emitCounted(ProgramBuilder& b, Regix& inner, size_t min, size_t max) {
+        if ((max == SIZE_MAX ? min : max) <= b.maxUnrolled) return false;
+
+        CharSet set;
+        Capture* captured = nullptr;
+        if (!inner.byteSet(set)) {
+            if (inner.kind != Kind::Capture) return false;
+            captured = static_cast<Capture*>(&inner);
+            if (captured->inner.size() != 1 || !captured->inner[0]->byteSet(set)) return false;
+        }
 
-        explicit Group(std::vector<std::unique_ptr<Regix>> inner): inner(std::move(inner)) {}
+        auto low = min;
+        auto high = max;
+        uint32_t split = 0;
+        if (captured) {
+            // without any round the capture is skipped as well
+            if (min == 0) split = b.emit({Op::Split});
+            else low--;
+            if (max != SIZE_MAX) high--;
+        }
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            long matchAmount = 0;
-            auto src = source;
+        auto bound = high == SIZE_MAX ? low : high;
+        if (bound > 0) b.emit({Op::Repeat, 0, b.addCounter(set, low, bound)});
+        if (high == SIZE_MAX) {
+            auto loop = b.emit({Op::Split});
+            b.emit({Op::Class, 0, b.addClass(set)});
+            b.emit({Op::Jmp, 0, loop});
+            b.at(loop).x = b.pc();
+        }
 
-            for (auto& matcher : inner) {
-                auto res = matcher->match(src, matches);
-                if (res < 0) {
-                    return -1;
-                }
-                matchAmount += res;
-                src = utils::slice(src, res);
-            }
+        if (captured) {
+            if (!captured->emit(b)) return false;
+            if (min == 0) b.at(split).x = b.pc();
+        }
+        return true;
+    }
 
-            return matchAmount;
+    struct Group: public Regix {
+        NodeList inner;
+
+        explicit Group(NodeList inner): Regix(Kind::Group), inner(std::move(inner)) {}
+
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            return matchSequence(inner, 0, source, matches, budget);
+        }
+
+        long retry(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   Budget* budget, long below) override {
+            return inner.size() == 1 ? inner[0]->retry(source, matches, budget, below) : -1;
         }
 
         void print(int offset = 0) override {
@@ -267,19 +627,81 @@ namespace regix {
                 in->print(offset);
             }
         }
+
+        bool emit(ProgramBuilder& b) override {
+            for (auto& in : inner) {
+                if (!in->emit(b)) return false;
+            }
+            return true;
+        }
+
+        bool byteSet(CharSet& out) override {
+            return inner.size() == 1 && inner[0]->byteSet(out);
+        }
     };
 
+    // whether retry can find a shorter match of node
+    inline bool givesBack(Regix& node) {
+        switch (node.kind) {
+            case Kind::Repeat: {
+                auto& repeat = static_cast<Repeat&>(node);
+                return repeat.min < repeat.max;
+            }
+            case Kind::Capture: {
+                auto& inner = static_cast<Capture&>(node).inner;
+                return inner.size() == 1 && givesBack(*inner[0]);
+            }
+            case Kind::Group: {
+                auto& inner = static_cast<Group&>(node).inner;
+                return inner.size() == 1 && givesBack(*inner[0]);
+            }
+            default:
+                return false;
+        }
+    }
+
+    // nodes from from on one after the other, a node that gives rounds back is retried shorter as long as the
+    // nodes after it fail, dropping the captures of the attempt before
+    inline long matchSequence(NodeList& nodes, size_t from, std::string_view source,
+                              std::vector<std::vector<std::string_view>>& matches, Budget* budget) {
+        long total = 0;
+        for (auto i = from; i < nodes.size(); i++) {
+            auto& node = *nodes[i];
+            auto src = utils::slice(source, total);
+
+            if (i + 1 < nodes.size() && givesBack(node)) {
+                auto marks = captureMarks(matches);
+                auto res = node.match(src, matches, budget);
+                while (res >= 0) {
+                    auto rest = matchSequence(nodes, i + 1, utils::slice(src, res), matches, budget);
+                    if (rest >= 0) return total + res + rest;
+
+                    dropCaptures(matches, marks);
+                    if (budget && (budget->exceeded() || budget->charge(1))) return -1;
+                    res = node.retry(src, matches, budget, res);
+                }
+                return -1;
+            }
+
+            auto res = node.match(src, matches, budget);
+            if (res < 0) return -1;
+            total += res;
+        }
+        return total;
+    }
+
     struct Or: public Regix {
-        std::unique_ptr<Regix> right;
-        std::unique_ptr<Regix> left;
+        Node right;
+        Node left;
 
-        explicit Or(std::unique_ptr<Regix> left, std::unique_ptr<Regix> right): right(std::move(right)), left(std::move(left)) {}
+        explicit Or(Node left, Node right): Regix(Kind::Or), right(std::move(right)), left(std::move(left)) {}
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            auto res = left->match(source, matches);
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            auto res = left->match(source, matches, budget);
 
             if (res < 0) {
-                return right->match(source, matches);
+                return right->match(source, matches, budget);
             }
             return res;
         }
@@ -288,15 +710,34 @@ namespace regix {
             PRINT_REPEAT(' ', offset*2);
             std::cout << "OR" << std::endl;
         }
+
+        bool emit(ProgramBuilder& b) override {
+            auto split = b.emit({Op::Split});
+            if (!left->emit(b)) return false;
+            auto jmp = b.emit({Op::Jmp});
+            b.at(split).x = b.pc();
+            if (!right->emit(b)) return false;
+            b.at(jmp).x = b.pc();
+            return true;
+        }
+
+        bool byteSet(CharSet& out) override {
+            CharSet rightSet;
+            if (!left->byteSet(out) || !right->byteSet(rightSet)) return false;
+            out |= rightSet;
+            return true;
+        }
     };
 
     struct Not: public Regix {
-        std::unique_ptr<Regix> inner;
+        Node inner;
 
-        explicit Not(std::unique_ptr<Regix> inner): inner(std::move(inner)) {}
+        explicit Not(Node inner): Regix(Kind::Not), inner(std::move(inner)) {}
 
-        long match(std::string_view source, std::vector<std::vector<std::string_view>> &matches) override {
-            return inner->match(source, matches) < 0 ? 1 : -1;
+        long run(std::string_view source, std::vector<std::vector<std::string_view>> &matches,
+                 Budget* budget) override {
+            if (source.empty()) return -1;
+            return inner->match(source, matches, budget) < 0 ? 1 : -1;
         }
 
         void print(int offset = 0) override {
@@ -304,10 +745,113 @@ namespace regix {
             std::cout << "NOT" << std::endl;
             inner->print(++offset);
         }
+
+        // only negation of single byte nodes has a flat form
+        bool emit(ProgramBuilder& b) override {
+            CharSet set;
+            if (!byteSet(set)) return false;
+            b.emit({Op::Class, 0, b.addClass(set)});
+            return true;
+        }
+
+        bool byteSet(CharSet& out) override {
+            if (!inner->byteSet(out)) return false;
+            out = ~out;
+            return true;
+        }
     };
 
-    bool parseSimpleRegix(lexer::Lexer& l, std::vector<std::unique_ptr<Regix>>& previous) {
-        std::vector<std::unique_ptr<Regix>> buf;
+    // \l letter, \d digit, \w whitespace
+    constexpr bool shorthandClass(char c, CharSet& out) {
+        switch (c) {
+            case 'l':
+                out = CharSet::letters();
+                return true;
+            case 'd':
+                out = CharSet::digits();
+                return true;
+            case 'w':
+                out = CharSet::whitespace();
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // body of [...] after the opening bracket, a leading ^ negates the class and a-z adds a range
+    constexpr bool parseClass(lexer::Lexer& l, CharSet& out) {
+        auto negated = l.isPeek('^');
+        if (negated) l.consume();
+
+        while (!l.isDone() && !l.isPeek(']')) {
+            auto c = l.data[l.index];
+            l.consume();
+
+            if (c == '\\') {
+                if (l.isDone()) return false;
+
+                c = l.data[l.index];
+                l.consume();
+
+                CharSet set;
+                if (shorthandClass(c, set)) {
+                    out |= set;
+                    continue;
+                }
+            }
+
+            // a - right before ] is a literal
+            if (l.isPeek('-') && l.index + 1 < l.data.size() && l.data[l.index + 1] != ']') {
+                l.consume();
+
+                auto to = l.data[l.index];
+                l.consume();
+                if (to == '\\') {
+                    if (l.isDone()) return false;
+                    to = l.data[l.index];
+                    l.consume();
+                }
+                if ((unsigned char) to < (unsigned char) c) return false;
+
+                out.setRange(c, to);
+            }
+            else {
+                out.set(c);
+            }
+        }
+        if (!l.isPeek(']')) return false;
+        l.consume();
+
+        if (negated) out = ~out;
+        return true;
+    }
+
+    // body of {n}, {n,m} or {n,} after the opening brace, max is SIZE_MAX for {n,}, false when it is not a count
+    // counts are clamped just above maxRepeatCount so long digit runs cant overflow
+    constexpr bool parseCount(lexer::Lexer& l, size_t& min, size_t& max) {
+        auto number = [&](size_t& out) {
+            auto start = l.index;
+            out = 0;
+            while (!l.isDone() && l.data[l.index] >= '0' && l.data[l.index] <= '9') {
+                out = std::min(out * 10 + (l.data[l.index] - '0'), maxRepeatCount + 1);
+                l.consume();
+            }
+            return l.index > start;
+        };
+
+        if (!number(min)) return false;
+        max = min;
+        if (l.isPeek(',')) {
+            l.consume();
+            if (!number(max)) max = SIZE_MAX;
+        }
+        if (!l.isPeek('}')) return false;
+        l.consume();
+        return true;
+    }
+
+    bool parseSimpleRegix(lexer::Lexer& l, NodeList& previous, Arena& arena) {
+        auto buf = arena.list();
 
         while (l.isPeek(1, [](auto c) {return !invalidChars.contains(c[0]);})) {
             auto c = l.data[l.index];
@@ -318,62 +862,53 @@ namespace regix {
 
                 auto p = l.data[l.index];
                 l.consume();
-                switch (p) {
-                    case 'l':
-                        buf.push_back(std::make_unique<Letter>());
-                        break;
-                    case 'd':
-                        buf.push_back(std::make_unique<Numeric>());
-                        break;
-                    case 'w':
-                        buf.push_back(std::make_unique<Whitespace>());
-                        break;
-                    default:
-                        buf.push_back(std::make_unique<Char>(p));
+
+                CharSet set;
+                if (shorthandClass(p, set)) {
+                    buf.push_back(arena.make<CharClass>(set));
+                }
+                else {
+                    buf.push_back(arena.make<Char>(p));
                 }
             }
             else {
-                buf.push_back(std::make_unique<Char>(c));
+                buf.push_back(arena.make<Char>(c));
             }
         }
         if (buf.empty()) return false;
 
-        previous.push_back(std::make_unique<Group>(std::move(buf)));
+        previous.push_back(arena.make<Group>(std::move(buf)));
 
         return true;
     }
 
-    bool parseRegix(lexer::Lexer& l, std::vector<std::unique_ptr<Regix>>& previous, long& captureGroups) {
+    bool parseRegix(lexer::Lexer& l, NodeList& previous, long& captureGroups, Arena& arena) {
+        if (l.isDone()) return false;
         auto c = l.data[l.index];
 
         switch (c) {
             case '(': {
                 l.consume();
 
-                auto buf = std::vector<std::unique_ptr<Regix>>();
+                auto buf = arena.list();
 
-                while (!l.isPeek(')')) {
-                    parseRegix(l, buf, captureGroups);
+                while (!l.isDone() && !l.isPeek(')')) {
+                    if (!parseRegix(l, buf, captureGroups, arena)) return false;
                 }
                 if (!l.isPeek(')')) return false;
                 l.consume();
 
-                previous.push_back(std::make_unique<Capture>(std::move(buf), captureGroups++));
+                previous.push_back(arena.make<Capture>(std::move(buf), captureGroups++));
 
                 return true;
             }
             case '[': {
                 l.consume();
 
-                auto buf = std::vector<std::unique_ptr<Regix>>();
+                CharSet set;
+                if (!parseClass(l, set)) return false;
 
-                while (!l.isPeek(']')) {
-                    parseRegix(l, buf, captureGroups);
-                }
-                if (!l.isPeek(']')) return false;
-                l.consume();
-
-                previous.push_back(std::make_unique<Group>(std::move(buf)));
+                previous.push_back(arena.make<CharClass>(set));
 
                 return true;
             }
@@ -383,13 +918,12 @@ namespace regix {
                 auto left = std::move(previous[previous.size() - 1]);
                 previous.pop_back();
 
-                auto right = std::vector<std::unique_ptr<Regix>>();
-                parseRegix(l, right, captureGroups);
-                if (right.size() != 1) {
+                auto right = arena.list();
+                if (!parseRegix(l, right, captureGroups, arena) || right.size() != 1) {
                     return false;
                 }
 
-                previous.push_back(std::make_unique<Or>(std::move(left), std::move(right[0])));
+                previous.push_back(arena.make<Or>(std::move(left), std::move(right[0])));
 
                 return true;
             }
@@ -403,7 +937,7 @@ namespace regix {
                 auto prev = std::move(previous[previous.size() - 1]);
                 previous.pop_back();
 
-                previous.push_back(std::make_unique<Optional>(std::move(prev)));
+                previous.push_back(arena.make<Optional>(std::move(prev)));
 
                 return true;
             }
@@ -416,7 +950,7 @@ namespace regix {
                 auto prev = std::move(previous[previous.size() - 1]);
                 previous.pop_back();
 
-                previous.push_back(std::make_unique<XAndMore>(std::move(prev), 0));
+                previous.push_back(arena.make<XAndMore>(std::move(prev), 0));
 
                 return true;
             }
@@ -430,44 +964,286 @@ namespace regix {
                 auto prev = std::move(previous[previous.size() - 1]);
                 previous.pop_back();
 
-                previous.push_back(std::make_unique<XAndMore>(std::move(prev), 1));
+                previous.push_back(arena.make<XAndMore>(std::move(prev), 1));
+
+                return true;
+            }
+            case '{': {
+                auto at = l.index;
+                l.consume();
+
+                size_t min, max;
+                if (!parseCount(l, min, max)) {
+                    // not a count, the brace stands for itself
+                    l.index = at + 1;
+                    previous.push_back(arena.make<Char>('{'));
+                    return true;
+                }
+                if (previous.empty() || min > max || min > maxRepeatCount ||
+                    (max != SIZE_MAX && max > maxRepeatCount)) {
+                    return false;
+                }
+
+                auto prev = std::move(previous[previous.size() - 1]);
+                previous.pop_back();
+
+                if (max == SIZE_MAX) previous.push_back(arena.make<XAndMore>(std::move(prev), min));
+                else previous.push_back(arena.make<Repeat>(std::move(prev), min, max));
 
                 return true;
             }
             case '.': {
                 l.consume();
 
-                previous.push_back(std::make_unique<Any>());
+                previous.push_back(arena.make<Any>());
 
                 return true;
             }
             case '^': {
                 l.consume();
-                auto buf = std::vector<std::unique_ptr<Regix>>();
-
-                parseRegix(l, buf, captureGroups);
+                auto buf = arena.list();
 
-                if (buf.size() != 1) {
+                if (!parseRegix(l, buf, captureGroups, arena) || buf.size() != 1) {
                     return false;
                 }
 
-                previous.push_back(std::make_unique<Not>(std::move(buf[0])));
+                previous.push_back(arena.make<Not>(std::move(buf[0])));
 
                 return true;
             }
             default:
-                return parseSimpleRegix(l, previous);
+                return parseSimpleRegix(l, previous, arena);
         }
     }
 
-    std::unique_ptr<Regix> constructRegix(std::string_view str) {
+    Node optimize(Node node, Arena& arena);
+
+    bool hasCapture(Regix& node) {
+        auto any = [](NodeList& list) {
+            return std::any_of(list.begin(), list.end(), [](auto& in) { return hasCapture(*in); });
+        };
+
+        switch (node.kind) {
+            case Kind::Capture:
+                return true;
+            case Kind::Group:
+                return any(static_cast<Group&>(node).inner);
+            case Kind::XAndMore:
+                return hasCapture(*static_cast<XAndMore&>(node).inner);
+            case Kind::Repeat:
+                return hasCapture(*static_cast<Repeat&>(node).inner);
+            case Kind::Optional:
+                return hasCapture(*static_cast<Optional&>(node).inner);
+            case Kind::Or: {
+                auto& alternation = static_cast<Or&>(node);
+                return hasCapture(*alternation.left) || hasCapture(*alternation.right);
+            }
+            case Kind::Not:
+                return hasCapture(*static_cast<Not&>(node).inner);
+            default:
+                return false;
+        }
+    }
+
+    // optimizes every node of a sequence, splices nested groups into it and merges runs of chars into literals
+    NodeList optimizeList(NodeList list, Arena& arena) {
+        auto flat = arena.list();
+        for (auto& node : list) {
+            node = optimize(std::move(node), arena);
+
+            if (node->kind == Kind::Group) {
+                for (auto& in : static_cast<Group*>(node.get())->inner) {
+                    flat.push_back(std::move(in));
+                }
+            }
+            else {
+                flat.push_back(std::move(node));
+            }
+        }
+
+        auto res = arena.list();
+        std::string run;
+        auto flush = [&]() {
+            if (run.size() == 1) res.push_back(arena.make<Char>(run[0]));
+            else if (run.size() > 1) res.push_back(arena.make<Literal>(run));
+            run.clear();
+        };
+
+        for (auto& node : flat) {
+            if (node->kind == Kind::Char) {
+                run += static_cast<Char*>(node.get())->c;
+            }
+            else if (node->kind == Kind::Literal) {
+                run += static_cast<Literal*>(node.get())->str;
+            }
+            else {
+                flush();
+                res.push_back(std::move(node));
+            }
+        }
+        flush();
+
+        return res;
+    }
+
+    // rewrites a tree into one that matches the same way with fewer nodes to walk, single byte nodes become one
+    // class, nested repeats collapse into one and groups only remain where a sequence is needed
+    // captures are never merged or moved, so the tree and the flat engines report the same spans as before
+    Node optimize(Node node, Arena& arena) {
+        switch (node->kind) {
+            case Kind::Group: {
+                auto group = static_cast<Group*>(node.get());
+                group->inner = optimizeList(std::move(group->inner), arena);
+                if (group->inner.size() == 1) return std::move(group->inner[0]);
+                return node;
+            }
+            case Kind::Capture: {
+                auto capture = static_cast<Capture*>(node.get());
+                capture->inner = optimizeList(std::move(capture->inner), arena);
+                return node;
+            }
+            case Kind::XAndMore: {
+                auto repeat = static_cast<XAndMore*>(node.get());
+                auto inner = optimize(std::move(repeat->inner), arena);
+                auto amount = repeat->amount;
+
+                // (x+)* is x*, (x{n,})+ is x{n,}, (x*)+ and (x?)* loop on the empty match and are taken as x*
+                // an outer count above one or (x{n,})* for n above one need rounds the inner node does not give
+                // back, so they stay as they are
+                // a capture keeps its rounds, the flat engines report the span of the last one and folding the
+                // rounds together, or dropping an empty one, would change that span
+                if (hasCapture(*inner)) return arena.make<XAndMore>(std::move(inner), amount);
+                if (inner->kind == Kind::XAndMore) {
+                    auto nested = static_cast<XAndMore*>(inner.get());
+                    if (amount == 1 || (amount == 0 && nested->amount <= 1)) {
+                        return arena.make<XAndMore>(std::move(nested->inner), amount == 1 ? nested->amount : 0);
+                    }
+                }
+                if (inner->kind == Kind::Optional && amount <= 1) {
+                    return arena.make<XAndMore>(std::move(static_cast<Optional*>(inner.get())->inner), 0);
+                }
+
+                // rebuilt so the single byte scan is set up for the new inner node
+                return arena.make<XAndMore>(std::move(inner), amount);
+            }
+            case Kind::Repeat: {
+                auto repeat = static_cast<Repeat*>(node.get());
+                auto inner = optimize(std::move(repeat->inner), arena);
+
+                // x{1} is x and x{0} matches nothing, unless x holds a capture that still has to be counted
+                // x{0,1} stays a repeat, unlike x? it gives its round back
+                if (repeat->max == 1 && repeat->min == 1) return inner;
+                if (repeat->max == 0 && !hasCapture(*inner)) return arena.make<Group>(arena.list());
+
+                return arena.make<Repeat>(std::move(inner), repeat->min, repeat->max);
+            }
+            case Kind::Optional: {
+                auto optional = static_cast<Optional*>(node.get());
+                optional->inner = optimize(std::move(optional->inner), arena);
+                if (hasCapture(*optional->inner)) return node;
+
+                // x+? and x*? are x*, while (x{n,})? still fails on fewer than n rounds
+                if (optional->inner->kind == Kind::XAndMore) {
+                    auto repeat = static_cast<XAndMore*>(optional->inner.get());
+                    if (repeat->amount <= 1) return arena.make<XAndMore>(std::move(repeat->inner), 0);
+                }
+                if (optional->inner->kind == Kind::Optional) {
+                    return std::move(optional->inner);
+                }
+                return node;
+            }
+            case Kind::Or: {
+                auto alternation = static_cast<Or*>(node.get());
+                alternation->left = optimize(std::move(alternation->left), arena);
+                alternation->right = optimize(std::move(alternation->right), arena);
+                break;
+            }
+            case Kind::Not: {
+                auto negation = static_cast<Not*>(node.get());
+                negation->inner = optimize(std::move(negation->inner), arena);
+                break;
+            }
+            case Kind::Any:
+            case Kind::Char:
+            case Kind::CharClass:
+                return node;
+            case Kind::Literal:
+                break;
+        }
+
+        // anything matching exactly one byte out of a set, like a|b or ^a, is a class
+        CharSet set;
+        if (node->byteSet(set)) return arena.make<CharClass>(set);
+        return node;
+    }
+
+    // parsed pattern, the root together with the arena holding every node of the tree
+    struct Tree {
+        std::unique_ptr<Arena> arena;
+        // null when the pattern is malformed
+        Node root;
+
+        Tree(std::unique_ptr<Arena> arena, Node root): arena(std::move(arena)), root(std::move(root)) {}
+        Tree(Tree&&) = default;
+
+        // the nodes of root live in arena, so they have to go before it is replaced
+        Tree& operator=(Tree&& other) {
+            root.reset();
+            arena = std::move(other.arena);
+            root = std::move(other.root);
+            return *this;
+        }
+
+        Regix* operator->() const {
+            return root.get();
+        }
+
+        Regix& operator*() const {
+            return *root;
+        }
+
+        explicit operator bool() const {
+            return root != nullptr;
+        }
+
+        // match of the root metered by budget, which also counts the bytes a repeat scans over
+        // Budget::Exceeded when it ran out, the captures are then incomplete
+        long match(std::string_view source, std::vector<std::vector<std::string_view>>& matches,
+                   Budget& budget) const {
+            auto res = root->match(source, matches, budget.begin());
+            return budget.exceeded() ? Budget::Exceeded : res;
+        }
+    };
+
+    // the arena starts with a block sized for the pattern, so most trees fit in one allocation
+    // without optimized the tree is left as parsed, which is what the optimize pass is checked against
+    Tree constructRegix(std::string_view str, bool optimized = true) {
+        Tree tree{std::make_unique<Arena>(256 + 64 * str.size()), nullptr};
+        auto& arena = *tree.arena;
+
         lexer::Lexer lexer(str);
-        long captureId;
-        std::vector<std::unique_ptr<Regix>> buf;
+        long captureId = 0;
+        auto buf = arena.list();
 
         while (!lexer.isDone()) {
-            parseRegix(lexer, buf, captureId);
+            if (!parseRegix(lexer, buf, captureId, arena)) return tree;
         }
-        return std::make_unique<Group>(std::move(buf));
+        tree.root = arena.make<Group>(std::move(buf));
+        if (optimized) tree.root = optimize(std::move(tree.root), arena);
+        return tree;
+    }
+
+    // counts of one byte over maxUnrolled rounds become Repeat instructions
+    std::optional<Program> compileProgram(Regix& root, size_t maxUnrolled = ProgramBuilder::defaultMaxUnrolled) {
+        ProgramBuilder b;
+        b.maxUnrolled = maxUnrolled;
+
+        b.emit({Op::Save, 0, 0});
+        if (!root.emit(b)) return std::nullopt;
+        b.emit({Op::Save, 0, 1});
+        b.emit({Op::Match});
+        b.markSpans();
+
+        return std::move(b.prog);
     }
 }
\ No newline at end of file
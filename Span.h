@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "CharSet.h"
+
+namespace regix {
+    // counts how many leading bytes of a buffer belong to a set, 32 bytes per step with AVX2 and 16 with SSE4.2
+    // the set is stored transposed as two tables indexed by the low nibble of a byte, low holds membership for
+    // high nibbles 0..7 as bits and high for 8..15, so a pshufb per table and a bit select by the high nibble
+    // test a whole vector without touching the bitmap byte by byte
+    struct Span {
+        CharSet set;
+        alignas(16) uint8_t low[16]{};
+        alignas(16) uint8_t high[16]{};
+
+        explicit Span(const CharSet& set = {}): set(set) {
+            for (unsigned c = 0; c < 256; c++) {
+                if (!set.contains(c)) continue;
+
+                if (c < 128) low[c & 15] |= 1 << (c >> 4);
+                else high[c & 15] |= 1 << ((c >> 4) - 8);
+            }
+        }
+
+        size_t operator()(const char* data, size_t len) const {
+#if defined(__x86_64__)
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            static const bool sse42 = __builtin_cpu_supports("sse4.2");
+
+            if (avx2 && len >= 32) return spanAvx2(data, len);
+            if (sse42 && len >= 16) return spanSse42(data, len);
+#endif
+            return spanScalar(data, len, 0);
+        }
+
+    private:
+        size_t spanScalar(const char* data, size_t len, size_t i) const {
+            while (i < len && set.contains(data[i])) {
+                i++;
+            }
+            return i;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("avx2")))
+        size_t spanAvx2(const char* data, size_t len) const {
+            auto lowTable = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) low));
+            auto highTable = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) high));
+            auto bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                         1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+            auto nibble = _mm256_set1_epi8(0x0f);
+
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32) {
+                auto v = _mm256_loadu_si256((const __m256i*) (data + i));
+                auto lo = _mm256_and_si256(v, nibble);
+                auto hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+
+                // top bit of v picks the table for high nibbles 8..15
+                auto row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lowTable, lo), _mm256_shuffle_epi8(highTable, lo), v);
+                auto bit = _mm256_shuffle_epi8(bits, hi);
+                auto hit = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+
+                uint32_t miss = ~(uint32_t) _mm256_movemask_epi8(hit);
+                if (miss) return i + __builtin_ctz(miss);
+            }
+
+            return spanScalar(data, len, i);
+        }
+
+        __attribute__((target("sse4.2")))
+        size_t spanSse42(const char* data, size_t len) const {
+            auto lowTable = _mm_load_si128((const __m128i*) low);
+            auto highTable = _mm_load_si128((const __m128i*) high);
+            auto bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+            auto nibble = _mm_set1_epi8(0x0f);
+
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16) {
+                auto v = _mm_loadu_si128((const __m128i*) (data + i));
+                auto lo = _mm_and_si128(v, nibble);
+                auto hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+
+                auto row = _mm_blendv_epi8(_mm_shuffle_epi8(lowTable, lo), _mm_shuffle_epi8(highTable, lo), v);
+                auto bit = _mm_shuffle_epi8(bits, hi);
+                auto hit = _mm_cmpeq_epi8(_mm_and_si128(row, bit), bit);
+
+                uint32_t miss = ~(uint32_t) _mm_movemask_epi8(hit) & 0xffff;
+                if (miss) return i + __builtin_ctz(miss);
+            }
+
+            return spanScalar(data, len, i);
+        }
+#endif
+    };
+}
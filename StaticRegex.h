@@ -0,0 +1,512 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <string_view>
+
+#include "Regix.h"
+
+namespace regix {
+    // pattern text passed as a template argument
+    template<size_t N>
+    struct FixedString {
+        char data[N]{};
+
+        constexpr FixedString(const char (&str)[N]) {
+            std::copy_n(str, N, data);
+        }
+
+        constexpr std::string_view view() const {
+            return {data, N - 1};
+        }
+    };
+
+    // pattern parsed at compile time into a nested type per node of the tree, so matching is plain inlined calls
+    // without heap nodes or virtual dispatch, a malformed pattern fails to compile
+    // results are the ones of Pattern for the same pattern
+    namespace ct {
+        using Matches = std::vector<std::vector<std::string_view>>;
+
+        enum class Kind {
+            Any,
+            Char,
+            Class,
+            Repeat,
+            Optional,
+            Capture,
+            Group,
+            Or,
+            Not,
+        };
+
+        struct Node {
+            Kind kind = Kind::Group;
+            char c = 0;
+            CharSet set;
+            // minimum count of a Repeat, id of a Capture
+            long value = 0;
+            // maximum count of a Repeat
+            size_t max = SIZE_MAX;
+            // Group and Capture own children[first, first + count), Repeat, Optional and Not have their inner
+            // node at first and Or has left at first and right at second
+            size_t first = 0;
+            size_t count = 0;
+            size_t second = 0;
+        };
+
+        struct Tree {
+            std::vector<Node> nodes;
+            std::vector<size_t> children;
+            size_t root = 0;
+            bool ok = true;
+        };
+
+        constexpr bool isSpecial(char c) {
+            return std::string_view("([|?*+{.^])").find(c) != std::string_view::npos;
+        }
+
+        constexpr size_t add(Tree& t, Node node) {
+            t.nodes.push_back(node);
+            return t.nodes.size() - 1;
+        }
+
+        constexpr size_t addList(Tree& t, Kind kind, const std::vector<size_t>& list, long value = 0) {
+            Node node{kind};
+            node.value = value;
+            node.first = t.children.size();
+            node.count = list.size();
+            t.children.insert(t.children.end(), list.begin(), list.end());
+            return add(t, node);
+        }
+
+        // same grammar as parseRegix, nodes are indices into t.nodes
+        constexpr bool parseSimple(lexer::Lexer& l, Tree& t, std::vector<size_t>& previous) {
+            std::vector<size_t> buf;
+
+            while (!l.isDone() && !isSpecial(l.data[l.index])) {
+                auto c = l.data[l.index];
+                l.consume();
+
+                if (c == '\\') {
+                    if (l.isDone()) return false;
+
+                    auto p = l.data[l.index];
+                    l.consume();
+
+                    Node node{Kind::Class};
+                    if (!shorthandClass(p, node.set)) {
+                        node.kind = Kind::Char;
+                        node.c = p;
+                    }
+                    buf.push_back(add(t, node));
+                }
+                else {
+                    Node node{Kind::Char};
+                    node.c = c;
+                    buf.push_back(add(t, node));
+                }
+            }
+            if (buf.empty()) return false;
+
+            previous.push_back(addList(t, Kind::Group, buf));
+            return true;
+        }
+
+        constexpr bool parse(lexer::Lexer& l, Tree& t, std::vector<size_t>& previous, long& captureGroups) {
+            if (l.isDone()) return false;
+
+            auto unary = [&](Kind kind, long value = 0) {
+                l.consume();
+                if (previous.empty()) return false;
+
+                Node node{kind};
+                node.value = value;
+                node.first = previous.back();
+                previous.back() = add(t, node);
+                return true;
+            };
+
+            switch (l.data[l.index]) {
+                case '(': {
+                    l.consume();
+
+                    std::vector<size_t> buf;
+                    while (!l.isDone() && !l.isPeek(')')) {
+                        if (!parse(l, t, buf, captureGroups)) return false;
+                    }
+                    if (!l.isPeek(')')) return false;
+                    l.consume();
+
+                    previous.push_back(addList(t, Kind::Capture, buf, captureGroups++));
+                    return true;
+                }
+                case '[': {
+                    l.consume();
+
+                    Node node{Kind::Class};
+                    if (!parseClass(l, node.set)) return false;
+
+                    previous.push_back(add(t, node));
+                    return true;
+                }
+                case '|': {
+                    l.consume();
+                    if (previous.empty()) return false;
+
+                    std::vector<size_t> right;
+                    if (!parse(l, t, right, captureGroups) || right.size() != 1) return false;
+
+                    Node node{Kind::Or};
+                    node.first = previous.back();
+                    node.second = right[0];
+                    previous.back() = add(t, node);
+                    return true;
+                }
+                case '?':
+                    return unary(Kind::Optional);
+                case '*':
+                    return unary(Kind::Repeat, 0);
+                case '+':
+                    return unary(Kind::Repeat, 1);
+                case '{': {
+                    auto at = l.index;
+                    l.consume();
+
+                    size_t min, max;
+                    if (!parseCount(l, min, max)) {
+                        l.index = at + 1;
+                        Node node{Kind::Char};
+                        node.c = '{';
+                        previous.push_back(add(t, node));
+                        return true;
+                    }
+                    // only maxRepeatCount applies, nothing here is unrolled into a program
+                    if (previous.empty() || min > max || min > maxRepeatCount ||
+                        (max != SIZE_MAX && max > maxRepeatCount)) {
+                        return false;
+                    }
+
+                    Node node{Kind::Repeat};
+                    node.value = min;
+                    node.max = max;
+                    node.first = previous.back();
+                    previous.back() = add(t, node);
+                    return true;
+                }
+                case '.':
+                    l.consume();
+                    previous.push_back(add(t, Node{Kind::Any}));
+                    return true;
+                case '^': {
+                    l.consume();
+
+                    std::vector<size_t> buf;
+                    if (!parse(l, t, buf, captureGroups) || buf.size() != 1) return false;
+
+                    Node node{Kind::Not};
+                    node.first = buf[0];
+                    previous.push_back(add(t, node));
+                    return true;
+                }
+                default:
+                    return parseSimple(l, t, previous);
+            }
+        }
+
+        constexpr Tree parseTree(std::string_view str) {
+            Tree t;
+            lexer::Lexer l(str);
+            long captureGroups = 0;
+            std::vector<size_t> buf;
+
+            while (!l.isDone()) {
+                if (!parse(l, t, buf, captureGroups)) {
+                    t.ok = false;
+                    return t;
+                }
+            }
+            t.root = addList(t, Kind::Group, buf);
+            return t;
+        }
+
+        // the parsed tree copied out of its vectors so it can outlive constant evaluation
+        template<size_t NodeCount, size_t ChildCount>
+        struct Ast {
+            std::array<Node, NodeCount> nodes;
+            std::array<size_t, ChildCount> children;
+            size_t root;
+            bool ok;
+        };
+
+        template<FixedString P>
+        consteval auto build() {
+            constexpr auto nodeCount = parseTree(P.view()).nodes.size();
+            constexpr auto childCount = parseTree(P.view()).children.size();
+
+            auto t = parseTree(P.view());
+            Ast<nodeCount, childCount> res{};
+            std::copy(t.nodes.begin(), t.nodes.end(), res.nodes.begin());
+            std::copy(t.children.begin(), t.children.end(), res.children.begin());
+            res.root = t.root;
+            res.ok = t.ok;
+            return res;
+        }
+
+        template<FixedString P>
+        inline constexpr auto ast = build<P>();
+
+        // a match in progress, slots holds start and end of every capture on the path being tried
+        template<size_t Slots>
+        struct State {
+            std::string_view source;
+            std::array<long, Slots> slots;
+        };
+
+        // node types in continuation passing style, match(s, pos, k) tries every way the node matches at pos in
+        // priority order and hands the end of each to k, the rest of the pattern, until k accepts one
+        // that is the backtracking of the flat engines, an unbounded repeat stops a round that matched empty like
+        // the PikeVM does, so the results are the ones of Pattern
+        // there is no memo of tried positions, nested repeats of the same input can take exponential time
+
+        template<class Node, class S, class K>
+        constexpr bool leaf(S& s, size_t pos, K&& k) {
+            return pos < s.source.size() && Node::test(s.source[pos]) && k(pos + 1);
+        }
+
+        struct AnyNode {
+            static constexpr bool test(unsigned char) {
+                return true;
+            }
+
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return leaf<AnyNode>(s, pos, k);
+            }
+        };
+
+        template<char C>
+        struct CharNode {
+            static constexpr bool test(unsigned char c) {
+                return c == (unsigned char) C;
+            }
+
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return leaf<CharNode>(s, pos, k);
+            }
+        };
+
+        template<CharSet Set>
+        struct ClassNode {
+            static constexpr bool test(unsigned char c) {
+                return Set.contains(c);
+            }
+
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return leaf<ClassNode>(s, pos, k);
+            }
+        };
+
+        template<class... Inner>
+        struct GroupNode;
+
+        template<>
+        struct GroupNode<> {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return k(pos);
+            }
+        };
+
+        template<class First, class... Rest>
+        struct GroupNode<First, Rest...> {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return First::match(s, pos, [&](size_t end) {
+                    return GroupNode<Rest...>::match(s, end, k);
+                });
+            }
+        };
+
+        template<long Id, class... Inner>
+        struct CaptureNode {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                auto start = s.slots[2 * Id];
+                auto end = s.slots[2 * Id + 1];
+
+                s.slots[2 * Id] = pos;
+                auto res = GroupNode<Inner...>::match(s, pos, [&](size_t to) {
+                    auto last = s.slots[2 * Id + 1];
+                    s.slots[2 * Id + 1] = to;
+                    if (k(to)) return true;
+
+                    s.slots[2 * Id + 1] = last;
+                    return false;
+                });
+                if (res) return true;
+
+                s.slots[2 * Id] = start;
+                s.slots[2 * Id + 1] = end;
+                return false;
+            }
+        };
+
+        // Amount rounds that must match, then more up to Max, each round is given back when the rest fails
+        template<class Inner, long Amount, size_t Max = SIZE_MAX>
+        struct RepeatNode {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                // a single byte inner is one scan, then the ends are handed out longest first
+                if constexpr (requires { Inner::test('a'); }) {
+                    size_t run = 0;
+                    while (run < Max && pos + run < s.source.size() && Inner::test(s.source[pos + run])) run++;
+
+                    for (size_t n = run + 1; n-- > (size_t) Amount;) {
+                        if (k(pos + n)) return true;
+                    }
+                    return false;
+                }
+                else {
+                    return round(s, pos, 0, k);
+                }
+            }
+
+            template<class S, class K>
+            static constexpr bool round(S& s, size_t pos, size_t count, K& k) {
+                if (count < (size_t) Amount) {
+                    return Inner::match(s, pos, [&](size_t end) {
+                        return round(s, end, count + 1, k);
+                    });
+                }
+
+                auto more = count < Max && Inner::match(s, pos, [&](size_t end) {
+                    // an unbounded loop back to where the round started is a thread the PikeVM already has
+                    return (Max != SIZE_MAX || end != pos) && round(s, end, count + 1, k);
+                });
+                return more || k(pos);
+            }
+        };
+
+        template<class Inner>
+        struct OptionalNode {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return Inner::match(s, pos, k) || k(pos);
+            }
+        };
+
+        template<class Left, class Right>
+        struct OrNode {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                return Left::match(s, pos, k) || Right::match(s, pos, k);
+            }
+        };
+
+        // one byte at which inner does not match, whatever inner captured on the way is dropped
+        template<class Inner>
+        struct NotNode {
+            template<class S, class K>
+            static constexpr bool match(S& s, size_t pos, K&& k) {
+                if (pos >= s.source.size()) return false;
+
+                auto slots = s.slots;
+                auto inner = Inner::match(s, pos, [](size_t) { return true; });
+                s.slots = slots;
+                return !inner && k(pos + 1);
+            }
+        };
+
+        template<FixedString P, size_t I>
+        constexpr auto nodeOf();
+
+        template<FixedString P, size_t I, size_t... K>
+        constexpr auto listOf(std::index_sequence<K...>) {
+            constexpr auto& node = ast<P>.nodes[I];
+            if constexpr (node.kind == Kind::Capture) {
+                return CaptureNode<node.value, decltype(nodeOf<P, ast<P>.children[node.first + K]>())...>{};
+            }
+            else {
+                return GroupNode<decltype(nodeOf<P, ast<P>.children[node.first + K]>())...>{};
+            }
+        }
+
+        template<FixedString P, size_t I>
+        constexpr auto nodeOf() {
+            constexpr auto& node = ast<P>.nodes[I];
+
+            if constexpr (node.kind == Kind::Any) return AnyNode{};
+            else if constexpr (node.kind == Kind::Char) return CharNode<node.c>{};
+            else if constexpr (node.kind == Kind::Class) return ClassNode<node.set>{};
+            else if constexpr (node.kind == Kind::Repeat) {
+                return RepeatNode<decltype(nodeOf<P, node.first>()), node.value, node.max>{};
+            }
+            else if constexpr (node.kind == Kind::Optional) return OptionalNode<decltype(nodeOf<P, node.first>())>{};
+            else if constexpr (node.kind == Kind::Not) return NotNode<decltype(nodeOf<P, node.first>())>{};
+            else if constexpr (node.kind == Kind::Or) {
+                return OrNode<decltype(nodeOf<P, node.first>()), decltype(nodeOf<P, node.second>())>{};
+            }
+            else return listOf<P, I>(std::make_index_sequence<node.count>{});
+        }
+
+        template<FixedString P>
+        constexpr auto rootOf() {
+            if constexpr (ast<P>.ok) return nodeOf<P, ast<P>.root>();
+            else return AnyNode{};
+        }
+    }
+
+    // regix::StaticRegex<"[a-z]+@[a-z]+">::doesMatch(str), usable in constant expressions as well
+    template<FixedString P>
+    struct StaticRegex {
+        static_assert(ct::ast<P>.ok, "regix::StaticRegex: malformed pattern");
+
+        using Root = decltype(ct::rootOf<P>());
+
+        static constexpr size_t captureCount = std::count_if(ct::ast<P>.nodes.begin(), ct::ast<P>.nodes.end(),
+                                                             [](auto& node) { return node.kind == ct::Kind::Capture; });
+
+        // captures are reported like Pattern::match does, one entry per group holding its last span when it took part
+        static constexpr long match(std::string_view source, ct::Matches& matches) {
+            return run(source, false, &matches);
+        }
+
+        static constexpr long match(std::string_view source) {
+            return run(source, false, nullptr);
+        }
+
+        static constexpr bool doesMatch(std::string_view source) {
+            return run(source, true, nullptr) >= 0;
+        }
+
+    private:
+        static constexpr long run(std::string_view source, bool fullMatch, ct::Matches* matches) {
+            ct::State<2 * captureCount> s{source, {}};
+            s.slots.fill(-1);
+
+            long res = -1;
+            Root::match(s, 0, [&](size_t end) {
+                if (fullMatch && end != source.size()) return false;
+
+                res = end;
+                if (matches) {
+                    matches->resize(captureCount);
+                    for (size_t i = 0; i < captureCount; i++) {
+                        auto start = s.slots[2 * i];
+                        auto to = s.slots[2 * i + 1];
+                        if (start >= 0 && to >= start) (*matches)[i].push_back(source.substr(start, to - start));
+                    }
+                }
+                return true;
+            });
+            return res;
+        }
+    };
+
+    template<FixedString P>
+    using static_regex = StaticRegex<P>;
+}
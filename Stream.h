@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "PikeVM.h"
+
+namespace regix {
+    // matches a stream given in chunks without keeping it around, the same successive leftmost-first matches
+    // as Pattern::findAll on the concatenated input are reported with offsets from the start of the stream
+    // the state between chunks is one list of threads that only remember where their match started, bytes are
+    // only held back while a found match can still be replaced by a longer one of higher priority, since the
+    // search for the next match restarts right after it
+    struct StreamMatcher {
+        struct Match {
+            size_t start;
+            size_t end;
+        };
+
+        explicit StreamMatcher(const Program& prog):
+            vm(prog), clist(prog.insts.size()), nlist(prog.insts.size()),
+            cstarts(prog.insts.size()), nstarts(prog.insts.size()) {
+            stack.reserve(prog.insts.size());
+        }
+
+        // consumes the next chunk, returns the matches it completed which stay valid until the next call
+        const std::vector<Match>& feed(std::string_view chunk) {
+            found.clear();
+            for (unsigned char c : chunk) {
+                step(&c);
+                drain();
+            }
+            return found;
+        }
+
+        // ends the stream and reports what was still pending, the matcher is then ready for a new stream
+        const std::vector<Match>& finish() {
+            found.clear();
+            while (true) {
+                auto before = found.size();
+                step(nullptr);
+                drain();
+                if (found.size() == before) break;
+            }
+
+            clist.clear();
+            pos = 0;
+            searchFrom = 0;
+            pending = false;
+            held.clear();
+            return found;
+        }
+
+    private:
+        PikeVM vm;
+        ThreadList clist;
+        ThreadList nlist;
+        // start offset of every thread
+        std::vector<size_t> cstarts;
+        std::vector<size_t> nstarts;
+        std::vector<PikeVM::Frame> stack;
+        std::vector<Match> found;
+
+        // offset of the next byte
+        size_t pos = 0;
+        // no match may start before this
+        size_t searchFrom = 0;
+        // last is a match that is reported once no thread of higher priority is alive
+        bool pending = false;
+        Match last{};
+        // bytes after last.end, they are searched again when last is reported
+        std::string held;
+        std::string replay;
+        size_t replayAt = 0;
+
+        // advances every thread over c, nullptr is the end of the stream
+        void step(const unsigned char* c) {
+            // a new thread of lowest priority starts at every position until something matched
+            if (!pending && pos >= searchFrom) addThread(clist, cstarts, 0, pos);
+
+            nlist.clear();
+            vm.step(clist, c, [&](uint32_t pc) {
+                pending = true;
+                last = {cstarts[pc], pos};
+                held.clear();
+                return true;
+            }, [&](uint32_t id) {
+                StartThread thread{nstarts, cstarts[id]};
+                vm.addNext(nlist, stack, clist, id, thread);
+            });
+
+            std::swap(clist, nlist);
+            std::swap(cstarts, nstarts);
+
+            if (c) {
+                pos++;
+                if (pending) held += *c;
+            }
+            if (pending && clist.size == 0) complete();
+        }
+
+        // reports last and rewinds to its end, bytes held after it go in front of whatever waits for a replay
+        void complete() {
+            found.push_back(last);
+            pending = false;
+
+            held.append(replay, replayAt);
+            std::swap(replay, held);
+            held.clear();
+            replayAt = 0;
+
+            pos = last.end;
+            // an empty match moves the next search one byte further
+            searchFrom = last.end + (last.start == last.end ? 1 : 0);
+        }
+
+        void drain() {
+            while (replayAt < replay.size()) {
+                unsigned char c = replay[replayAt++];
+                step(&c);
+            }
+            replay.clear();
+            replayAt = 0;
+        }
+
+        // a thread only carries the offset its match started at
+        struct StartThread {
+            std::vector<size_t>& starts;
+            size_t start;
+
+            bool save(uint32_t slot, long& old) {
+                return false;
+            }
+
+            void restore(uint32_t slot, long old) {}
+
+            void store(uint32_t id) {
+                // counted threads go past the instructions
+                if (id >= starts.size()) starts.resize(id + 1);
+                starts[id] = start;
+            }
+        };
+
+        void addThread(ThreadList& list, std::vector<size_t>& starts, uint32_t pc, size_t start) {
+            StartThread thread{starts, start};
+            vm.addThread(list, stack, pc, thread);
+        }
+    };
+}
@@ -0,0 +1,219 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include "Pattern.h"
+#include "Parallel.h"
+#include "StaticRegex.h"
+#include "FlatTree.h"
+
+// usage: regix_bench [filter] [samples]
+// every case is timed per engine, a sample runs the engine in a batch long enough to be above timer noise
+// and the first samples are thrown away as warm-up, the report lists median and p99 of time per call
+
+namespace bench {
+    struct Case {
+        std::string name;
+        std::string pattern;
+        std::string input;
+        // full match through doesMatch and match, otherwise unanchored search
+        bool full;
+    };
+
+    struct Stats {
+        double median;
+        double p99;
+    };
+
+    volatile long sink;
+
+    Stats measure(const std::function<long()>& f, size_t samples) {
+        using clock = std::chrono::steady_clock;
+
+        // grow the batch until one sample takes at least 200us
+        size_t batch = 1;
+        while (true) {
+            auto start = clock::now();
+            for (size_t i = 0; i < batch; i++) sink = f();
+            if (clock::now() - start > std::chrono::microseconds(200) || batch >= (1 << 24)) break;
+            batch *= 2;
+        }
+
+        std::vector<double> times;
+        for (size_t s = 0; s < samples + samples / 5; s++) {
+            auto start = clock::now();
+            for (size_t i = 0; i < batch; i++) sink = f();
+            std::chrono::duration<double, std::nano> d = clock::now() - start;
+
+            // first fifth is warm-up
+            if (s >= samples / 5) times.push_back(d.count() / batch);
+        }
+
+        std::sort(times.begin(), times.end());
+        return {times[times.size() / 2], times[std::min(times.size() - 1, times.size() * 99 / 100)]};
+    }
+
+    std::string repeat(std::string_view str, size_t size) {
+        std::string res;
+        while (res.size() < size) res += str;
+        res.resize(size);
+        return res;
+    }
+
+    std::vector<Case> cases() {
+        auto text = repeat("the quick brown fox jumps over the lazy dog ", 64 * 1024);
+
+        return {
+            {"char/short/match", "uwu", "uwu", true},
+            {"char/short/miss", "uwu", "uwx", true},
+            {"literal/long/search-hit", "needle", text + "needle", false},
+            {"literal/long/search-miss", "needle", text, false},
+            {"any/long/match", ".+", text, true},
+            {"class/short/match", "[a-z0-9_]+", "snake_case_42", true},
+            {"class/short/miss", "[a-z0-9_]+", "snake_Case_42", true},
+            {"class/long/match", "\\d+", repeat("7", 16 * 1024), true},
+            {"class/long/miss", "\\d+", repeat("7", 16 * 1024) + "x", true},
+            {"class/long/search", "\\d\\d\\d-\\d\\d\\d", text + "555-123", false},
+            {"alternation/short/match", "error|fatal|panic|timeout", "timeout", true},
+            {"alternation/short/miss", "error|fatal|panic|timeout", "warning", true},
+            {"alternation/long/search", "error|fatal|panic|timeout", text + "panic", false},
+            {"optional/short/match", "colo[u]?r", "colour", true},
+            {"capture/short/match", "(\\d+)-(\\d+)", "123-456", true},
+            {"capture/long/match", "(ab)+", repeat("ab", 4 * 1024), true},
+            {"not/long/match", "^a+", repeat("b", 16 * 1024), true},
+            {"group/short/match", "[a-z]+@[a-z]+", "someone@example", true},
+        };
+    }
+
+    void report(const Case& c, std::string_view engine, Stats stats) {
+        auto bytes = std::max<size_t>(c.input.size(), 1);
+
+        std::cout << std::left << std::setw(28) << c.name << std::setw(14) << engine
+                  << std::right << std::setw(9) << c.input.size()
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << stats.median << std::setw(14) << stats.p99
+                  << std::setprecision(3)
+                  << std::setw(10) << stats.median / bytes
+                  << std::setw(9) << bytes / stats.median << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    size_t samples = argc > 2 ? std::stoul(argv[2]) : 50;
+
+    std::cout << std::left << std::setw(28) << "case" << std::setw(14) << "engine"
+              << std::right << std::setw(9) << "bytes" << std::setw(14) << "median ns" << std::setw(14) << "p99 ns"
+              << std::setw(10) << "ns/byte" << std::setw(9) << "GB/s" << std::endl;
+
+    for (auto& c : bench::cases()) {
+        if (c.name.find(filter) == std::string::npos) continue;
+
+        auto pattern = regix::compile(c.pattern);
+        auto ctx = pattern->context();
+
+        if (c.full) {
+            auto tree = regix::constructRegix(c.pattern);
+            std::vector<std::vector<std::string_view>> matches;
+
+            bench::report(c, "tree", bench::measure([&]() {
+                matches.clear();
+                return tree->match(c.input, matches);
+            }, samples));
+            bench::report(c, "tree-full", bench::measure([&]() {
+                return tree->doesMatch(c.input);
+            }, samples));
+
+            regix::FlatTree flat(*tree);
+            bench::report(c, "flat", bench::measure([&]() {
+                matches.clear();
+                return flat.match(c.input, matches);
+            }, samples));
+            bench::report(c, "flat-full", bench::measure([&]() {
+                return flat.doesMatch(c.input);
+            }, samples));
+            bench::report(c, "match", bench::measure([&]() {
+                return pattern->match(c.input, ctx);
+            }, samples));
+            bench::report(c, "dfa-full", bench::measure([&]() {
+                return pattern->doesMatch(c.input, ctx);
+            }, samples));
+
+            if (pattern->bits) {
+                bench::report(c, "bits-full", bench::measure([&]() {
+                    return pattern->bits->doesMatch(c.input);
+                }, samples));
+            }
+
+            auto jit = regix::compile(c.pattern, true);
+            if (jit->native) {
+                bench::report(c, "jit-full", bench::measure([&]() {
+                    return jit->doesMatch(c.input);
+                }, samples));
+            }
+        }
+        else {
+            bench::report(c, "search", bench::measure([&]() {
+                auto found = pattern->search(c.input, ctx);
+                return found ? (long) found->size() : -1;
+            }, samples));
+
+            bench::report(c, "contains", bench::measure([&]() {
+                return pattern->contains(c.input);
+            }, samples));
+
+            regix::ParallelScan parallel(pattern->prog, std::thread::hardware_concurrency(), 64 * 1024);
+            bench::report(c, "parallel-any", bench::measure([&]() {
+                return parallel.contains(c.input);
+            }, samples));
+            bench::report(c, "parallel-lines", bench::measure([&]() {
+                return (long) parallel.countMatchingLines(c.input);
+            }, samples));
+        }
+    }
+
+    // pattern parsed at compile time against the same pattern through the tree
+    if (std::string_view("static/short/match").find(filter) != std::string::npos) {
+        bench::Case c{"static/short/match", "[a-z]+@[a-z]+", "someone@example", true};
+        auto tree = regix::constructRegix(c.pattern);
+
+        bench::report(c, "tree-full", bench::measure([&]() {
+            return tree->doesMatch(c.input);
+        }, samples));
+        bench::report(c, "static-full", bench::measure([&]() {
+            return regix::static_regex<"[a-z]+@[a-z]+">::doesMatch(c.input);
+        }, samples));
+    }
+
+    // a column of short rows, matched row by row and through the batch entry point
+    if (std::string_view("column/short/match").find(filter) != std::string::npos) {
+        bench::Case c{"column/short/match", "[a-z]+@[a-z]+", "", true};
+        std::vector<int32_t> offsets{0};
+        for (size_t i = 0; i < 10000; i++) {
+            c.input += i % 3 ? "someone@example" : "some one@example";
+            offsets.push_back(c.input.size());
+        }
+
+        auto pattern = regix::compile(c.pattern);
+        auto ctx = pattern->context();
+        auto rows = offsets.size() - 1;
+        std::vector<uint64_t> selection((rows + 63) / 64);
+
+        bench::report(c, "rows", bench::measure([&]() {
+            long n = 0;
+            for (size_t i = 0; i < rows; i++) {
+                n += pattern->doesMatch(std::string_view(c.input).substr(offsets[i], offsets[i + 1] - offsets[i]), ctx);
+            }
+            return n;
+        }, samples));
+        bench::report(c, "column", bench::measure([&]() {
+            pattern->doesMatchColumn(c.input.data(), offsets.data(), rows, selection.data(), ctx);
+            return (long) selection[0];
+        }, samples));
+    }
+
+    return 0;
+}
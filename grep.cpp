@@ -0,0 +1,252 @@
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Pattern.h"
+
+// usage: regix-grep [-c] [-j threads] pattern path...
+// prints every line of the files under path that the pattern is found in, directories are searched recursively
+// exits with 0 when a line matched, 1 when none did and 2 on bad arguments or when a file could not be read, the
+// other files are still searched then
+// files are spread over a pool of threads that each buffer their output and flush it a whole file at a time
+
+namespace grep {
+    struct Options {
+        bool count = false;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        bool prefixNames = false;
+    };
+
+    // read only view of a whole file, error holds the errno when it cant be opened or mapped
+    struct Mapping {
+        const char* data = nullptr;
+        size_t size = 0;
+        int error = 0;
+
+        explicit Mapping(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                error = errno;
+                return;
+            }
+
+            struct stat st{};
+            if (fstat(fd, &st) != 0) {
+                error = errno;
+            }
+            else if (S_ISDIR(st.st_mode)) {
+                error = EISDIR;
+            }
+            else if (st.st_size > 0) {
+                auto addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    error = errno;
+                }
+                else {
+                    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                    data = (const char*) addr;
+                    size = st.st_size;
+                }
+            }
+            close(fd);
+        }
+
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        ~Mapping() {
+            if (data) munmap((void*) data, size);
+        }
+    };
+
+    // one per thread, the DFA runs the unanchored program to find the line holding the earliest match end
+    // and the line is then confirmed on its own, since a match may run over a newline
+    struct Searcher {
+        const regix::Pattern& pattern;
+        regix::LazyDFA dfa;
+        regix::MatchContext ctx;
+        std::string out;
+        // messages for stderr, flushed together with out
+        std::string errors;
+        size_t total = 0;
+        bool failed = false;
+
+        Searcher(const regix::Pattern& pattern, const regix::Program& unanchored):
+            pattern(pattern), dfa(unanchored, 8 << 20), ctx(pattern.context()) {}
+
+        void file(const std::string& path, const Options& options) {
+            Mapping map(path);
+            if (map.error) {
+                errors.append("regix-grep: ").append(path).append(": ").append(strerror(map.error)).push_back('\n');
+                failed = true;
+                return;
+            }
+            std::string_view source(map.data, map.size);
+
+            size_t matched = 0;
+            size_t from = 0;
+            while (from < source.size()) {
+                auto rest = source.substr(from);
+                auto end = dfa.tryFirstAccept(rest);
+                if (!end) {
+                    matched += byLine(path, rest, options);
+                    break;
+                }
+                if (*end == std::string_view::npos) break;
+
+                // line holding the match end
+                auto start = *end;
+                auto before = (const char*) memrchr(rest.data(), '\n', start);
+                start = before ? before - rest.data() + 1 : 0;
+                auto after = (const char*) memchr(rest.data() + *end, '\n', rest.size() - *end);
+                auto stop = after ? after - rest.data() : rest.size();
+
+                auto line = rest.substr(start, stop - start);
+                if (pattern.search(line, ctx)) {
+                    matched++;
+                    if (!options.count) print(path, line, options);
+                }
+
+                if (!after) break;
+                from += stop + 1;
+            }
+
+            total += matched;
+            if (options.count) {
+                if (options.prefixNames) out.append(path).push_back(':');
+                out.append(std::to_string(matched)).push_back('\n');
+            }
+        }
+
+        // plain line by line search, used when the DFA cache thrashes
+        size_t byLine(const std::string& path, std::string_view source, const Options& options) {
+            size_t matched = 0;
+            while (!source.empty()) {
+                auto after = (const char*) memchr(source.data(), '\n', source.size());
+                auto stop = after ? after - source.data() : source.size();
+
+                auto line = source.substr(0, stop);
+                if (pattern.search(line, ctx)) {
+                    matched++;
+                    if (!options.count) print(path, line, options);
+                }
+
+                if (!after) break;
+                source.remove_prefix(stop + 1);
+            }
+            return matched;
+        }
+
+        void print(const std::string& path, std::string_view line, const Options& options) {
+            if (options.prefixNames) out.append(path).push_back(':');
+            out.append(line).push_back('\n');
+        }
+    };
+
+    void collect(const std::string& path, std::vector<std::string>& files) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(path, ec)) {
+            files.push_back(path);
+            return;
+        }
+
+        auto it = std::filesystem::recursive_directory_iterator(
+            path, std::filesystem::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->is_regular_file(ec)) files.push_back(it->path().string());
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    grep::Options options;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        std::string_view flag = argv[arg];
+        if (flag == "-c") {
+            options.count = true;
+        }
+        else if (flag == "-j" && arg + 1 < argc) {
+            std::string_view value = argv[++arg];
+            size_t threads = 0;
+            auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), threads);
+            if (error != std::errc() || end != value.data() + value.size()) {
+                std::cerr << "invalid thread count " << value << std::endl;
+                return 2;
+            }
+            options.threads = std::max<size_t>(1, threads);
+        }
+        else {
+            std::cerr << "unknown option " << flag << std::endl;
+            return 2;
+        }
+    }
+    if (arg >= argc) {
+        std::cerr << "usage: regix-grep [-c] [-j threads] pattern path..." << std::endl;
+        return 2;
+    }
+
+    auto pattern = regix::compile(argv[arg++]);
+    if (!pattern) {
+        std::cerr << "invalid pattern" << std::endl;
+        return 2;
+    }
+    auto unanchored = regix::unanchored(pattern->prog);
+
+    std::vector<std::string> files;
+    for (; arg < argc; arg++) {
+        grep::collect(argv[arg], files);
+    }
+    options.prefixNames = files.size() > 1;
+
+    std::mutex outputLock;
+    std::atomic<bool> found = false;
+    std::atomic<bool> failed = false;
+    std::atomic<size_t> next = 0;
+    auto work = [&]() {
+        grep::Searcher searcher(*pattern, unanchored);
+
+        for (size_t i; (i = next++) < files.size();) {
+            searcher.file(files[i], options);
+
+            // whole files only so their lines stay together
+            if (searcher.out.size() >= 64 * 1024 || !searcher.errors.empty()) {
+                std::lock_guard guard(outputLock);
+                std::cout.write(searcher.out.data(), searcher.out.size());
+                std::cerr << searcher.errors;
+                searcher.out.clear();
+                searcher.errors.clear();
+            }
+        }
+
+        std::lock_guard guard(outputLock);
+        std::cout.write(searcher.out.data(), searcher.out.size());
+        if (searcher.total) found = true;
+        if (searcher.failed) failed = true;
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(options.threads, files.size()); i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::cout.flush();
+    if (failed) return 2;
+    return found ? 0 : 1;
+}
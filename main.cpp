@@ -1,21 +1,42 @@
 #include <iostream>
-#include <chrono>
-#include "Regix.h"
+#include "Pattern.h"
+#include "PatternInfo.h"
 
-int main() {
-    auto reg = regix::constructRegix("uwu");
+// usage: Regix [pattern] [input...]
+// prints the parsed tree, the analysis and the compiled program of pattern and how every input matches it,
+// timing lives in the regix_bench target
+int main(int argc, char** argv) {
+    std::string_view str = argc > 1 ? argv[1] : "uwu";
 
-    std::cout << "finished parsing" << std::endl;
+    auto tree = regix::constructRegix(str);
+    if (!tree) {
+        std::cerr << "invalid pattern" << std::endl;
+        return 1;
+    }
+    tree->print();
+    regix::analyze(str)->print();
 
-    // reg->print();
+    auto pattern = regix::compile(str);
+    if (!pattern) {
+        std::cout << "pattern has no compiled form" << std::endl;
+        return 0;
+    }
+    pattern->print();
 
-    auto res = measureTime([&]() {
-        bool volatile x;
-        for (auto i = 0; i < 1'000'000; i++) {
-            x = reg->doesMatch("uwu");
+    auto ctx = pattern->context();
+    for (auto i = 2; i < argc; i++) {
+        std::string_view input = argv[i];
+        auto found = pattern->search(input, ctx);
+
+        std::cout << '"' << input << "\" full: " << pattern->doesMatch(input, ctx) << " search: ";
+        if (found) {
+            std::cout << (found->data() - input.data()) << ".." << (found->data() - input.data() + found->size());
+        }
+        else {
+            std::cout << "none";
         }
-    });
-    std::cout << res << std::endl;
+        std::cout << std::endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,773 @@
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include "Pattern.h"
+#include "StaticRegex.h"
+#include "PatternInfo.h"
+#include "Parallel.h"
+#include "Stream.h"
+#include "FlatTree.h"
+#include "PatternFile.h"
+#include "RegexSet.h"
+#include "PatternCache.h"
+
+// usage: regix_test
+// random patterns and inputs run through the tree as parsed and as optimized, and through the programs lowered from
+// both, every pair has to agree on the match length and on the captures, followed by fixed cases of bugs found
+// before, exits with 1 when anything fails
+
+namespace test {
+    size_t failures = 0;
+
+    void fail(std::string_view what, std::string_view pattern, std::string_view input) {
+        if (failures++ < 20) {
+            std::cerr << what << ": pattern \"" << pattern << "\" input \"" << input << '"' << std::endl;
+        }
+    }
+
+    std::string randomPattern(std::mt19937& rng, int depth = 0) {
+        static const char* atoms[] = {"a", "b", "ab", "[ab]", "[^a]", ".", "\\d", "c"};
+        static const char* suffixes[] = {"", "", "*", "+", "?", "{2}", "{1,3}", "{0,2}", "{2,}"};
+
+        std::string res;
+        auto parts = 1 + rng() % 3;
+        for (size_t i = 0; i < parts; i++) {
+            if (depth < 2 && rng() % 3 == 0) res.append("(").append(randomPattern(rng, depth + 1)).append(")");
+            else res += atoms[rng() % std::size(atoms)];
+
+            res += suffixes[rng() % std::size(suffixes)];
+            if (rng() % 6 == 0) res += suffixes[rng() % std::size(suffixes)];
+            if (rng() % 8 == 0) res += std::string("|") + atoms[rng() % std::size(atoms)];
+        }
+        return res;
+    }
+
+    std::string randomInput(std::mt19937& rng) {
+        std::string res;
+        auto size = rng() % 12;
+        for (size_t i = 0; i < size; i++) {
+            res += "aabc15"[rng() % 6];
+        }
+        return res;
+    }
+
+    // the optimized tree and its program against the tree and program of the pattern as parsed
+    void optimizeKeepsResults(std::string_view pattern, std::mt19937& rng) {
+        auto parsed = regix::constructRegix(pattern, false);
+        auto optimized = regix::constructRegix(pattern);
+        if (!parsed || !optimized) return;
+
+        auto parsedProg = regix::compileProgram(*parsed);
+        auto optimizedProg = regix::compileProgram(*optimized);
+
+        for (int i = 0; i < 20; i++) {
+            auto input = randomInput(rng);
+
+            std::vector<std::vector<std::string_view>> expected, actual;
+            auto want = parsed->match(input, expected);
+            auto got = optimized->match(input, actual);
+            expected.resize(std::max(expected.size(), actual.size()));
+            actual.resize(expected.size());
+            if (want != got || (want >= 0 && expected != actual)) fail("tree", pattern, input);
+
+            if (!parsedProg || !optimizedProg) continue;
+
+            // slots of captures a repeat of zero dropped stay unset in both
+            std::vector<long> expectedSlots(parsedProg->slotCount(), -1), actualSlots(parsedProg->slotCount(), -1);
+            want = regix::PikeVM(*parsedProg).run(input, false, expectedSlots);
+            got = regix::PikeVM(*optimizedProg).run(input, false, actualSlots);
+            if (want != got || (want >= 0 && expectedSlots != actualSlots)) fail("program", pattern, input);
+        }
+    }
+
+    // native code of the full match against the PikeVM, on inputs with bytes above 0x7f that the emitted byte
+    // compares have to treat as unsigned
+    void jitKeepsResults(std::string_view pattern, std::mt19937& rng) {
+        auto compiled = regix::compile(pattern, true);
+        if (!compiled || !compiled->native) return;
+
+        regix::PikeVM vm(compiled->prog);
+        for (int i = 0; i < 10; i++) {
+            auto input = randomInput(rng);
+            for (auto& c : input) {
+                if (rng() % 4 == 0) c = "\x80\xe9\xff"[rng() % 3];
+            }
+
+            auto expected = vm.doesMatch(input);
+            if (compiled->native->doesMatch(input) != expected || compiled->doesMatch(input) != expected) {
+                fail("jit", pattern, input);
+            }
+        }
+    }
+
+    // the bit-parallel NFA against the PikeVM on the program and on its unanchored form, with and without the
+    // prefilter skipping ahead
+    void bitsKeepResults(std::string_view pattern, const std::vector<std::string>& inputs) {
+        auto compiled = regix::compile(pattern);
+        auto bits = compiled ? regix::BitNFA::compile(compiled->prog) : nullptr;
+        if (!bits) return;
+
+        regix::PikeVM vm(compiled->prog);
+        auto unanchored = regix::unanchored(compiled->prog);
+        regix::PikeVM search(unanchored);
+        for (auto& input : inputs) {
+            std::vector<long> slots(unanchored.slotCount(), -1);
+            auto found = search.run(input, false, slots) >= 0;
+            if (bits->doesMatch(input) != vm.doesMatch(input)) fail("bits full", pattern, input);
+            if (bits->contains(input) != found || bits->contains(input, &compiled->prefilter) != found) {
+                fail("bits contains", pattern, input);
+            }
+        }
+    }
+
+    // alternations of words looping back to their start give every last letter edges of its own, past
+    // BitNFA::maxSources of them the follow sets come from tables and the state may take more than one word
+    void bitTables(std::mt19937& rng) {
+        std::vector<std::string> words{"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+                                       "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"};
+        for (size_t count : {4, 10, 16}) {
+            std::string pattern = "(";
+            for (size_t i = 0; i < count; i++) pattern.append(i ? "|" : "").append(words[i]);
+            pattern += ")+!";
+
+            auto compiled = regix::compile(pattern);
+            auto bits = compiled ? regix::BitNFA::compile(compiled->prog) : nullptr;
+            if (!bits) {
+                fail("bits", pattern, "not compiled");
+                continue;
+            }
+            auto stateWords = (bits->positionCount() + 63) / 64;
+            auto tables = bits->memoryUsage() >= sizeof(regix::BitNFA) + 2 * 256 * stateWords * sizeof(uint64_t);
+            if (tables != (count > regix::BitNFA::maxSources) || (count == 16 && stateWords < 2)) {
+                fail("bits layout", pattern, "");
+            }
+
+            std::vector<std::string> inputs;
+            for (int k = 0; k < 50; k++) {
+                std::string input;
+                if (rng() % 2) input += "xy";
+                for (auto n = rng() % 5; n > 0; n--) {
+                    auto& word = words[rng() % std::min(count + 1, words.size())];
+                    input += rng() % 6 ? word : word.substr(0, word.size() - 1);
+                }
+                if (rng() % 3) input += '!';
+                if (rng() % 4 == 0) input += "zz";
+                inputs.push_back(input);
+            }
+            bitsKeepResults(pattern, inputs);
+        }
+    }
+
+    // alternations of random literals, up to Teddy::maxLiterals of them are found with Teddy and more with
+    // Aho-Corasick, the finder against the earliest occurrence of any literal and the search against the PikeVM
+    // tried at every position without a prefilter
+    void literalSearch(std::mt19937& rng) {
+        size_t teddy = 0, automaton = 0;
+        for (int round = 0; round < 200; round++) {
+            std::vector<std::string> literals(2 + rng() % 20);
+            std::string pattern;
+            for (auto& lit : literals) {
+                auto size = 2 + rng() % (round % 4 == 0 ? 20 : 5);
+                for (size_t i = 0; i < size; i++) lit += "abcd"[rng() % 4];
+                pattern.append(pattern.empty() ? "" : "|").append(lit);
+            }
+
+            auto compiled = regix::compile(pattern);
+            auto& prefilter = compiled->prefilter;
+            teddy += prefilter.teddy.has_value();
+            automaton += prefilter.automaton.has_value();
+
+            regix::PikeVM vm(compiled->prog);
+            std::vector<long> slots(compiled->prog.slotCount());
+            for (int k = 0; k < 10; k++) {
+                std::string input;
+                for (auto size = rng() % 300; input.size() < size;) {
+                    if (rng() % 8 == 0) input += literals[rng() % literals.size()];
+                    else input += "abcdx"[rng() % 5];
+                }
+
+                for (size_t from : {size_t(0), input.size() / 3, input.size()}) {
+                    auto expected = regix::Prefilter::npos;
+                    for (auto& lit : prefilter.literals) expected = std::min(expected, input.find(lit, from));
+                    if (!prefilter.literals.empty() && prefilter.next(input, from) != expected) {
+                        fail("literal finder", pattern, input);
+                    }
+                }
+
+                std::optional<std::string_view> expected;
+                for (size_t at = 0; at <= input.size() && !expected; at++) {
+                    auto rest = std::string_view(input).substr(at);
+                    std::fill(slots.begin(), slots.end(), -1);
+                    auto res = vm.run(rest, false, slots);
+                    if (res >= 0) expected = rest.substr(0, res);
+                }
+                auto got = compiled->search(input);
+                if (expected.has_value() != got.has_value() ||
+                    (expected && (expected->data() != got->data() || expected->size() != got->size()))) {
+                    fail("literal search", pattern, input);
+                }
+            }
+        }
+        if (!teddy || !automaton) fail("literal search", "", "both finders used");
+    }
+
+    // ids reported by a set against every pattern matched on its own, anywhere in the input or on all of it
+    void regexSet(std::mt19937& rng) {
+        for (auto anchored : {false, true}) {
+            for (int round = 0; round < 50; round++) {
+                std::vector<std::string> sources{"(ab){1025}", "c[a1]{70}5"};
+                for (auto n = 1 + rng() % 12; n > 0; n--) sources.push_back(randomPattern(rng));
+                std::shuffle(sources.begin(), sources.end(), rng);
+
+                regix::RegexSet set(anchored);
+                std::vector<std::unique_ptr<regix::Pattern>> patterns;
+                for (auto& source : sources) {
+                    auto compiled = regix::compile(source);
+                    auto id = set.add(source);
+                    if (id != (compiled ? long(patterns.size()) : -1)) fail("set id", source, "");
+                    if (compiled) patterns.push_back(std::move(compiled));
+                }
+                if (set.size() != patterns.size()) fail("set size", sources[0], "");
+
+                // a cache small enough to thrash
+                auto cache = set.cache(1 << 12);
+                std::vector<size_t> got;
+                for (int k = 0; k < 10; k++) {
+                    auto input = randomInput(rng);
+                    if (k % 3 == 0) input += "c" + std::string(70, 'a') + "5";
+
+                    std::vector<size_t> expected;
+                    for (size_t i = 0; i < patterns.size(); i++) {
+                        if (anchored ? patterns[i]->doesMatch(input) : patterns[i]->contains(input)) {
+                            expected.push_back(i);
+                        }
+                    }
+                    set.matches(input, cache, got);
+                    if (set.matches(input) != expected || got != expected) fail("set matches", sources[0], input);
+                }
+            }
+        }
+    }
+
+    // a column of rows matched in one call against doesMatch on every row, as a bitmap and as indices, with
+    // 32 and 64 bit offsets
+    template<class Offset>
+    void column(std::string_view pattern, std::mt19937& rng) {
+        auto compiled = regix::compile(pattern);
+        if (!compiled) return;
+        auto ctx = compiled->context();
+
+        for (size_t rows : {size_t(0), size_t(1), size_t(63), size_t(64), size_t(65), size_t(200)}) {
+            std::string data;
+            std::vector<Offset> offsets{0};
+            std::vector<uint32_t> expected;
+            for (size_t i = 0; i < rows; i++) {
+                auto row = randomInput(rng);
+                if (rng() % 4 == 0) row = "c" + std::string(70, 'a') + "5";
+                if (compiled->doesMatch(row)) expected.push_back(i);
+                data += row;
+                offsets.push_back(data.size());
+            }
+
+            // set bits have to be cleared and the word past the bitmap left alone
+            auto words = (rows + 63) / 64;
+            std::vector<uint64_t> selection(words + 1, ~uint64_t(0));
+            compiled->doesMatchColumn(data.data(), offsets.data(), rows, selection.data(), ctx);
+            std::vector<uint32_t> selected;
+            for (size_t i = 0; i < rows; i++) {
+                if (selection[i / 64] >> (i % 64) & 1) selected.push_back(i);
+            }
+            if (selected != expected || (rows % 64 && selection[words - 1] >> rows % 64 != 0) ||
+                selection[words] != ~uint64_t(0)) {
+                fail("column bitmap", pattern, std::to_string(rows) + " rows");
+            }
+
+            std::vector<uint32_t> indices{12345};
+            compiled->doesMatchColumn(data.data(), offsets.data(), rows, indices, ctx);
+            if (indices != expected) fail("column indices", pattern, std::to_string(rows) + " rows");
+        }
+    }
+
+    void columns(std::mt19937& rng) {
+        std::vector<std::string> patterns{"c[a1]{70}5", "(ab)+c?", "x*"};
+        for (int i = 0; i < 30; i++) patterns.push_back(randomPattern(rng));
+        for (auto& pattern : patterns) {
+            column<uint32_t>(pattern, rng);
+            column<int64_t>(pattern, rng);
+        }
+    }
+
+    // hits, misses and evictions of the cache, a single shard makes the LRU order deterministic
+    void patternCache() {
+        auto check = [](regix::PatternCache& cache, std::string_view what, size_t hits, size_t misses,
+                        size_t evictions, size_t entries) {
+            auto stats = cache.stats();
+            if (stats.hits != hits || stats.misses != misses || stats.evictions != evictions ||
+                stats.entries != entries) {
+                fail("cache stats", what, "");
+            }
+        };
+
+        regix::PatternCache cache(1 << 20, 1);
+        auto first = cache.get("a+");
+        if (!first || cache.get("a+") != first) fail("cache hit", "a+", "");
+        // failures are counted as misses but not kept
+        if (cache.get("(") || cache.get("(")) fail("cache failure", "(", "");
+        check(cache, "a+", 1, 3, 0, 1);
+        if (cache.stats().bytes != first->memoryUsage() + 2) fail("cache bytes", "a+", "");
+
+        // room for two entries of the same size, the least recently used one goes
+        auto size = regix::compile("a1")->memoryUsage() + 2;
+        regix::PatternCache small(2 * size + size / 2, 1);
+        auto a1 = small.get("a1");
+        small.get("a2");
+        small.get("a1");
+        small.get("a3");
+        check(small, "a3 over a2", 1, 3, 1, 2);
+        if (small.get("a1") != a1) fail("cache lru", "a1", "");
+        small.get("a2");
+        check(small, "a2 over a3", 2, 4, 2, 2);
+        if (small.stats().bytes != 2 * size) fail("cache bytes", "a1 a2", "");
+
+        // an entry over capacity on its own still stays as the newest one
+        regix::PatternCache tiny(1, 1);
+        tiny.get("a1");
+        tiny.get("a2");
+        check(tiny, "over capacity", 0, 2, 1, 1);
+
+        small.clear();
+        check(small, "clear", 2, 4, 2, 0);
+        if (small.stats().bytes != 0 || !a1->doesMatch("a1")) fail("cache clear", "a1", "");
+
+        // every call is a hit or a miss, racing misses of one key keep a single entry
+        regix::PatternCache shared(1 << 20, 4);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&shared]() {
+                for (int round = 0; round < 20; round++) {
+                    for (int k = 0; k < 50; k++) shared.get(std::string("a").append(std::to_string(k)).append("b*"));
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        auto stats = shared.stats();
+        if (stats.hits + stats.misses != 4 * 20 * 50 || stats.misses < 50 || stats.entries != 50) {
+            fail("cache threads", "a0b*", "");
+        }
+    }
+
+    // the flattened tree against the tree it was copied from, parsed and optimized
+    void flatKeepsResults(std::string_view pattern, std::mt19937& rng) {
+        for (auto optimized : {false, true}) {
+            auto tree = regix::constructRegix(pattern, optimized);
+            if (!tree) return;
+
+            regix::FlatTree flat(*tree);
+            for (int i = 0; i < 10; i++) {
+                auto input = randomInput(rng);
+
+                std::vector<std::vector<std::string_view>> expected, actual;
+                auto want = tree->match(input, expected);
+                auto got = flat.match(input, actual);
+                if (want != got || expected != actual || flat.doesMatch(input) != tree->doesMatch(input)) {
+                    fail("flat", pattern, input);
+                }
+            }
+        }
+    }
+
+    // a stream fed in random chunks finds what findAll finds on the whole input
+    void streamKeepsResults(std::string_view pattern, std::mt19937& rng) {
+        auto compiled = regix::compile(pattern);
+        if (!compiled) return;
+
+        regix::StreamMatcher stream(compiled->prog);
+        for (int i = 0; i < 5; i++) {
+            auto input = randomInput(rng) + randomInput(rng);
+
+            std::vector<std::pair<size_t, size_t>> expected, actual;
+            for (auto m : compiled->findAll(input)) {
+                auto start = m.data() - input.data();
+                expected.emplace_back(start, start + m.size());
+            }
+            for (size_t at = 0; at < input.size();) {
+                auto size = std::min<size_t>(1 + rng() % 4, input.size() - at);
+                for (auto m : stream.feed(std::string_view(input).substr(at, size))) {
+                    actual.emplace_back(m.start, m.end);
+                }
+                at += size;
+            }
+            for (auto m : stream.finish()) actual.emplace_back(m.start, m.end);
+
+            if (expected != actual) fail("stream", pattern, input);
+        }
+    }
+
+    // every count of one byte lowered to a Repeat against the program with all of them unrolled, on each engine
+    // taking a program, the DFA opts out and falls back
+    void countersKeepResults(std::string_view pattern, std::mt19937& rng) {
+        auto tree = regix::constructRegix(pattern);
+        if (!tree) return;
+        auto unrolledProg = regix::compileProgram(*tree, SIZE_MAX);
+        auto countedProg = regix::compileProgram(*tree, 0);
+        if (!unrolledProg || !countedProg) return;
+
+        regix::Pattern unrolled(std::move(*unrolledProg));
+        regix::Pattern counted(std::move(*countedProg));
+        auto ctx = counted.context();
+        regix::StreamMatcher stream(counted.prog);
+
+        for (int i = 0; i < 20; i++) {
+            auto input = randomInput(rng);
+
+            for (bool full : {false, true}) {
+                std::vector<long> want(unrolled.prog.slotCount(), -1), pike(want), back(want);
+                auto expected = regix::PikeVM(unrolled.prog).run(input, full, want);
+                if (regix::PikeVM(counted.prog).run(input, full, pike) != expected || (expected >= 0 && pike != want)) {
+                    fail("counter pike", pattern, input);
+                }
+                if (regix::Backtrack(counted.prog).run(input, full, back) != expected ||
+                    (expected >= 0 && back != want)) {
+                    fail("counter backtrack", pattern, input);
+                }
+            }
+
+            auto found = unrolled.search(input);
+            auto got = counted.search(input);
+            if (found.has_value() != got.has_value() ||
+                (found && (found->data() != got->data() || found->size() != got->size()))) {
+                fail("counter search", pattern, input);
+            }
+            auto full = unrolled.doesMatch(input);
+            if (counted.doesMatch(input) != full || counted.doesMatch(input, ctx) != full) {
+                fail("counter full", pattern, input);
+            }
+            if (counted.contains(input) != found.has_value()) fail("counter contains", pattern, input);
+
+            std::vector<std::pair<size_t, size_t>> expectedAll, actualAll;
+            for (auto m : unrolled.findAll(input)) {
+                expectedAll.emplace_back(m.data() - input.data(), m.data() - input.data() + m.size());
+            }
+            for (auto m : stream.feed(input)) actualAll.emplace_back(m.start, m.end);
+            for (auto m : stream.finish()) actualAll.emplace_back(m.start, m.end);
+            if (expectedAll != actualAll) fail("counter stream", pattern, input);
+        }
+    }
+
+    // the pattern parsed at compile time against the one compiled at run time, lengths, full matches and captures
+    template<regix::FixedString P>
+    void staticKeepsResults(std::mt19937& rng) {
+        using Static = regix::static_regex<P>;
+        auto pattern = regix::compile(P.view());
+        if (!pattern) return fail("compile", P.view(), "");
+
+        for (int i = 0; i < 300; i++) {
+            auto input = randomInput(rng);
+
+            std::vector<std::vector<std::string_view>> expected, actual;
+            auto want = pattern->match(input, expected);
+            auto got = Static::match(input, actual);
+            if (want != got || (want >= 0 && expected != actual)) fail("static", P.view(), input);
+            if (pattern->doesMatch(input) != Static::doesMatch(input)) fail("static full", P.view(), input);
+        }
+    }
+
+    void staticPatterns(std::mt19937& rng) {
+        staticKeepsResults<"a*a">(rng);
+        staticKeepsResults<"\\d{1,3}5">(rng);
+        staticKeepsResults<"(a|ab)(c|bcd)?">(rng);
+        staticKeepsResults<"(a*)+b">(rng);
+        staticKeepsResults<"(a?)*">(rng);
+        staticKeepsResults<"((a)|b)+c?">(rng);
+        staticKeepsResults<"(ab|a)*b?c">(rng);
+        staticKeepsResults<"[ab]*a[ab]{2}">(rng);
+        staticKeepsResults<"(a|b){2,}(1)?">(rng);
+        staticKeepsResults<"(.?){1,3}5">(rng);
+        staticKeepsResults<"a{2,}?b">(rng);
+        staticKeepsResults<"(\\d+)(a|b)*^c">(rng);
+
+        static_assert(regix::static_regex<"a*a">::doesMatch("aa"));
+        static_assert(regix::static_regex<"\\d{1,3}5">::match("125") == 3);
+    }
+
+    void expect(std::string_view pattern, std::string_view input, long length) {
+        auto tree = regix::constructRegix(pattern);
+        std::vector<std::vector<std::string_view>> matches;
+        if (!tree || tree->match(input, matches) != length) fail("tree", pattern, input);
+
+        auto prog = tree ? regix::compileProgram(*tree) : std::nullopt;
+        std::vector<long> slots(2, -1);
+        if (prog && regix::PikeVM(*prog).run(input, false, slots) != length) fail("program", pattern, input);
+    }
+
+    // nested repeats with counts above one used to collapse into a plain star
+    void nestedCounts() {
+        expect("a{2,}?b", "b", 1);
+        expect("a{2,}?b", "ab", -1);
+        expect("a{2,}?b", "aab", 3);
+        expect("\\d{2,}*", "1", 0);
+        expect("\\d{2,}*", "123", 3);
+        expect("(x{2,})*", "x", 0);
+        expect("x{3,}+", "xx", -1);
+        expect("x{3,}+", "xxxx", 4);
+        expect("(x{2,})?", "x", 0);
+        expect("(x{2,})+", "xxx", 3);
+        expect("(x+)*", "xx", 2);
+
+        if (regix::static_regex<"a{2,}?b">::match("ab") != -1) fail("static", "a{2,}?b", "ab");
+        if (regix::static_regex<"a{2,}?b">::match("aab") != 3) fail("static", "a{2,}?b", "aab");
+    }
+
+    // a bounded count gives rounds back when the rest of its sequence fails, like the flat engines
+    void countsGiveBack() {
+        expect("\\d{1,3}5", "125", 3);
+        expect("(\\d{1,3})5", "125", 3);
+        expect("a{0,1}a", "a", 1);
+        expect("(ab){1,3}ab", "ababab", 6);
+        expect("x{2,4}y{1,2}y", "xxxyy", 5);
+        expect("(a){0}(b)", "b", 1);
+
+        // the captures of the rounds given back are dropped
+        auto tree = regix::constructRegix("(a){1,3}a");
+        std::vector<std::vector<std::string_view>> matches;
+        if (!tree || tree->match("aaa", matches) != 3 || matches[0] != std::vector<std::string_view>{"a", "a"}) {
+            fail("give back captures", "(a){1,3}a", "aaa");
+        }
+        tree = regix::constructRegix("(a{1,3})a");
+        matches.clear();
+        if (!tree || tree->match("aaa", matches) != 3 || matches[0] != std::vector<std::string_view>{"aa"}) {
+            fail("give back captures", "(a{1,3})a", "aaa");
+        }
+
+        // a capture under x{0} is still counted
+        auto info = regix::analyze("(a){0}(b)", 0);
+        auto compiled = regix::compile("(a){0}(b)");
+        if (!info || !compiled || info->captureCount != 2 || compiled->prog.captureCount != 2) {
+            fail("analyze", "(a){0}(b)", "");
+        }
+    }
+
+    // a count of one byte past the unroll bound is one Repeat, other counts unroll up to maxRepeatEmitted and
+    // leave the pattern to the tree past it, a capture adds two instructions to every round
+    void countLimits() {
+        for (auto pattern : {"\\d{5000}", "[a-z]{100,4000}", "(a|b){2000}", "x{4096,}", "a{0,100000}", "a{1000}"}) {
+            auto compiled = regix::compile(pattern);
+            if (!compiled || compiled->prog.insts.size() > 16) fail("counter", pattern, "");
+        }
+        for (auto pattern : {"[a-f0-9]{32,64}", "(ab){1024}", "a{64}{64}", "a|b{3000}"}) {
+            if (!regix::compile(pattern)) fail("compile", pattern, "");
+        }
+        for (auto pattern : {"(ab){1025}", "a{64}{65}"}) {
+            if (!regix::constructRegix(pattern) || regix::compile(pattern)) fail("tree only", pattern, "");
+        }
+
+        expect("\\d{5000}", std::string(5000, '7'), 5000);
+        expect("\\d{5000}", std::string(4999, '7'), -1);
+        expect("[a-z]{100,4000}", std::string(4100, 'q'), 4000);
+        expect("(a|b){2000}c", std::string(1000, 'a') + std::string(1000, 'b') + "c", 2001);
+        expect("x{4096,}y", std::string(5000, 'x') + "y", 5001);
+        expect("(ab){1025}", std::string(2050, 'a'), -1);
+        // no flat form because of ^(ab), the tree counts
+        expect("(^(ab)){5000}", std::string(5000, 'c'), 5000);
+
+        // the capture of a counted group holds its last round
+        auto group = regix::compile("(a|b){100}");
+        std::vector<std::vector<std::string_view>> matches;
+        if (!group || group->match(std::string(99, 'a') + "b", matches) != 100 ||
+            matches[0] != std::vector<std::string_view>{"b"}) {
+            fail("counter capture", "(a|b){100}", "");
+        }
+
+        // the DFA opts out of a counter, the bit-parallel NFA counts
+        auto many = regix::compile("a[b]{1000}c");
+        auto ctx = many->context();
+        auto input = "a" + std::string(1000, 'b') + "c";
+        if (!many->bits || !many->doesMatch(input) || !many->doesMatch(input, ctx) || ctx.dfa.supported()) {
+            fail("counter engines", "a[b]{1000}c", "");
+        }
+        if (many->doesMatch("a" + std::string(999, 'b') + "c") || !many->contains("xx" + input + "xx")) {
+            fail("counter engines", "a[b]{1000}c", "short");
+        }
+    }
+
+    // the tree stops once its budget runs out and matches as before without a limit
+    void treeBudget() {
+        auto tree = regix::constructRegix("(^(ab)){5000}");
+        std::string input(5000, 'c');
+        std::vector<std::vector<std::string_view>> matches;
+
+        regix::Budget budget;
+        if (!tree || tree.match(input, matches, budget) != 5000) fail("budget", "(^(ab)){5000}", "unlimited");
+
+        budget.maxSteps = 1000;
+        if (!tree || tree.match(input, matches, budget) != regix::Budget::Exceeded || !budget.exceeded()) {
+            fail("budget", "(^(ab)){5000}", "1000 steps");
+        }
+
+        budget.maxSteps = 0;
+        budget.deadline = regix::Budget::Clock::now();
+        if (!tree || tree.match(input, matches, budget) != regix::Budget::Exceeded) {
+            fail("budget", "(^(ab)){5000}", "deadline");
+        }
+    }
+
+    // lines counted on several threads against a search of every line on its own
+    void matchingLines(std::mt19937& rng) {
+        for (auto pattern : {"a+", "b\\d", "x*", "c[a1]{70}5", "."}) {
+            auto compiled = regix::compile(pattern);
+            for (int round = 0; round < 20; round++) {
+                std::string input;
+                auto lines = rng() % 40;
+                for (size_t i = 0; i < lines; i++) {
+                    input += randomInput(rng);
+                    if (rng() % 5 == 0) input += "c" + std::string(70, "a1"[rng() % 2]) + "5";
+                    if (i + 1 < lines || rng() % 2) input += '\n';
+                }
+
+                size_t expected = 0;
+                for (size_t from = 0; from < input.size();) {
+                    auto stop = std::min(input.find('\n', from), input.size());
+                    expected += compiled->contains(std::string_view(input).substr(from, stop - from));
+                    from = stop + 1;
+                }
+
+                for (size_t threads : {1, 3, 8}) {
+                    regix::ParallelScan parallel(compiled->prog, threads, 16);
+                    if (parallel.countMatchingLines(input) != expected) fail("countMatchingLines", pattern, input);
+                }
+            }
+        }
+    }
+
+    // patterns saved to a file and mapped back, the saved tables and the loaded patterns against the originals
+    void patternFile(std::mt19937& rng) {
+        std::vector<std::string> sources{"error|fatal|panic", "[a-z]+@[a-z]+", "(ab)+c?", "x[0-9]{100}y", "a.b*"};
+        std::vector<std::unique_ptr<regix::Pattern>> patterns;
+        for (int i = 0; i < 30; i++) sources.push_back(randomPattern(rng));
+        for (auto& source : sources) patterns.push_back(regix::compile(source));
+        // no compiled form keeps its index
+        sources.push_back("(ab){1025}");
+        patterns.push_back(nullptr);
+
+        auto path = (std::filesystem::temp_directory_path() / "regix_test_patterns").string();
+        auto file = regix::PatternFile::save(path, patterns) ? regix::PatternFile::open(path) : nullptr;
+        std::filesystem::remove(path);
+        if (!file || file->count() != patterns.size()) {
+            fail("pattern file", path, "");
+            return;
+        }
+        // the counted pattern has no DFA and so no table, the others are small enough for one
+        if (!(*file)[0].hasTable() || (*file)[3].hasTable()) fail("pattern file", sources[0], "tables");
+
+        for (size_t i = 0; i < patterns.size(); i++) {
+            auto& image = (*file)[i];
+            auto loaded = image.load();
+            if (!patterns[i]) {
+                if (image.compiled() || loaded) fail("pattern file", sources[i], "null entry");
+                continue;
+            }
+            if (!loaded) {
+                fail("pattern file", sources[i], "load");
+                continue;
+            }
+
+            for (int k = 0; k < 20; k++) {
+                auto input = randomInput(rng) + (k % 2 ? "xx" + std::string(100, '7') + "yfatal" : "");
+                auto full = patterns[i]->doesMatch(input);
+                auto saved = image.tryDoesMatch(input);
+                if ((saved && *saved != full) || loaded->doesMatch(input) != full) {
+                    fail("pattern file full", sources[i], input);
+                }
+
+                auto expected = patterns[i]->search(input);
+                auto got = loaded->search(input);
+                if (expected.has_value() != got.has_value() ||
+                    (expected && (expected->data() != got->data() || expected->size() != got->size()))) {
+                    fail("pattern file search", sources[i], input);
+                }
+            }
+        }
+    }
+
+    // a cache too small for the pattern keeps clearing, the DFA then gives up and the results stay the same
+    void dfaThrash(std::mt19937& rng) {
+        auto pattern = regix::compile("[ab]*a[ab]{8}c");
+        regix::LazyDFA tiny(pattern->prog, 4096, 1000), thrashing(pattern->prog, 4096);
+
+        for (int i = 0; i < 200; i++) {
+            std::string input;
+            for (size_t j = 0; j < 512; j++) input += "ab"[rng() % 2];
+            input += 'c';
+
+            auto want = regix::PikeVM(pattern->prog).doesMatch(input);
+            auto got = tiny.tryDoesMatch(input);
+            if (!got || *got != want) fail("dfa clears", "[ab]*a[ab]{8}c", input);
+            if (thrashing.doesMatch(input) != want) fail("dfa fallback", "[ab]*a[ab]{8}c", input);
+        }
+        if (!tiny.cacheClears || !thrashing.fallbacks) fail("dfa thrash", "[ab]*a[ab]{8}c", "");
+    }
+
+    // a tree moved over another one drops the old nodes before their arena
+    void treeMove() {
+        auto tree = regix::constructRegix("abc(d+)e|f");
+        tree = regix::constructRegix("xyz");
+        if (!tree || !tree->doesMatch("xyz")) fail("move", "xyz", "xyz");
+
+        tree = regix::constructRegix("(");
+        if (tree) fail("move", "(", "");
+    }
+
+    // lengths of large counts saturate instead of wrapping around
+    void lengthBounds() {
+        auto info = regix::analyze("((((^(ab)){100000,}){100000,}){100000,}){100000,}", 0);
+        if (!info || info->minLength != regix::PatternInfo::unbounded) fail("analyze", "(^(ab)){100000,}...", "");
+
+        info = regix::analyze("(ab){3,}c", 0);
+        if (!info || info->minLength != 7 || info->maxLength != regix::PatternInfo::unbounded) {
+            fail("analyze", "(ab){3,}c", "");
+        }
+    }
+}
+
+int main() {
+    std::mt19937 rng(1);
+    for (int i = 0; i < 5000; i++) {
+        auto pattern = test::randomPattern(rng);
+        test::optimizeKeepsResults(pattern, rng);
+        test::streamKeepsResults(pattern, rng);
+        test::countersKeepResults(pattern, rng);
+        test::flatKeepsResults(pattern, rng);
+        test::jitKeepsResults(pattern, rng);
+        std::vector<std::string> inputs;
+        for (int k = 0; k < 10; k++) inputs.push_back(test::randomInput(rng));
+        test::bitsKeepResults(pattern, inputs);
+    }
+    test::nestedCounts();
+    test::countLimits();
+    test::countsGiveBack();
+    test::lengthBounds();
+    test::treeBudget();
+    test::treeMove();
+    test::staticPatterns(rng);
+    test::matchingLines(rng);
+    test::patternFile(rng);
+    test::bitTables(rng);
+    test::literalSearch(rng);
+    test::regexSet(rng);
+    test::columns(rng);
+    test::patternCache();
+#if defined(__x86_64__)
+    if (!regix::compile("[^a]+b", true)->native) test::fail("jit", "[^a]+b", "no native code");
+#endif
+    test::dfaThrash(rng);
+
+    if (test::failures) {
+        std::cerr << test::failures << " failures" << std::endl;
+        return 1;
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}